@@ -0,0 +1,279 @@
+/****************************************************************************
+ * bitbase.c - win/draw tables for tiny endings, solved at startup
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include "bitbase.h"
+#include "attacks.h"
+#include "bitscan.h"
+#include "popcnt.h"
+
+/**
+ * An ending the generator can solve. Positions are numbered 0 to size-1, and
+ * the ending says what it knows about each one from the rules alone, which
+ * positions are one move away, and what it means to have no moves at all.
+ * The "strong" side is the one trying to win.
+ */
+typedef struct bitbase_ending_t {
+	unsigned int size;
+	/* a BITBASE_* result, or BITBASE_UNKNOWN if it takes looking ahead.
+	 * moves that leave the ending (promoting, capturing) are judged here
+	 * since they have no index */
+	uint8_t (*init)(unsigned int);
+	int (*strongtomove)(unsigned int);
+	/* fills in the indices of the positions one move away, and returns
+	 * how many. it's fine to include illegal ones; init marks those
+	 * BITBASE_INVALID and they get skipped */
+	int (*successors)(unsigned int, unsigned int *);
+	/* the result when the side to move has no legal moves */
+	uint8_t (*nomoves)(unsigned int);
+} bitbase_ending_t;
+
+/* a king's 8 moves and a pawn's 2 is the most for our endings */
+#define BITBASE_MAX_SUCCESSORS 16
+
+/**
+ * Retrograde analysis, done the simple way: keep sweeping over the unsolved
+ * positions until a sweep changes nothing. The strong side wins if any move
+ * wins; the weak side draws if any move draws. Whatever is still unsolved at
+ * the end can't be forced, so it's a draw. Sets a bit for each win.
+ */
+static void bitbase_generate(bitbase_ending_t *ending, uint8_t *bits)
+{
+	uint8_t *work = malloc(ending->size);
+	unsigned int succ[BITBASE_MAX_SUCCESSORS];
+	unsigned int index;
+	int changed, i, n, legal, wins, draws;
+	uint8_t result;
+
+	for (index = 0; index < ending->size; index++)
+	{
+		work[index] = ending->init(index);
+	}
+	do
+	{
+		changed = 0;
+		for (index = 0; index < ending->size; index++)
+		{
+			if (work[index] != BITBASE_UNKNOWN)
+			{
+				continue;
+			}
+			n = ending->successors(index, succ);
+			legal = 0; wins = 0; draws = 0;
+			for (i = 0; i < n; i++)
+			{
+				switch (work[succ[i]])
+				{
+					case BITBASE_INVALID:
+						continue;
+					case BITBASE_WIN:
+						wins++;
+						break;
+					case BITBASE_DRAW:
+						draws++;
+						break;
+				}
+				legal++;
+			}
+			if (legal == 0)
+			{
+				result = ending->nomoves(index);
+			}
+			else if (ending->strongtomove(index))
+			{
+				result = wins ? BITBASE_WIN :
+				         (draws == legal) ? BITBASE_DRAW :
+				         BITBASE_UNKNOWN;
+			}
+			else
+			{
+				result = draws ? BITBASE_DRAW :
+				         (wins == legal) ? BITBASE_WIN :
+				         BITBASE_UNKNOWN;
+			}
+			if (result != BITBASE_UNKNOWN)
+			{
+				work[index] = result;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	for (index = 0; index < ending->size; index++)
+	{
+		if (work[index] == BITBASE_WIN)
+		{
+			bits[index >> 3] |= 1 << (index & 7);
+		}
+	}
+	free(work);
+}
+
+/****************************************************************************
+ * KP vs K. Always seen as white having the pawn, on files a-d (the board can
+ * be flipped and mirrored into that). Index layout:
+ * RRR FF WWWWWW BBBBBB S
+ *  15 13      7      1 0
+ * S: side to move (0 for white), B: black king, W: white king, F: pawn file,
+ * R: pawn rank counting down from the 7th (so 0-5). 24KB of bits.
+ ****************************************************************************/
+#define KPK_SIZE (2 * 64 * 64 * 4 * 6)
+#define KPK_INDEX(stm, wk, bk, wp) \
+	((stm) | ((bk) << 1) | ((wk) << 7) | (COL(wp) << 13) | \
+	 ((RANK_7 - ROW(wp)) << 15))
+#define KPK_STM(i) ((i) & 0x1)
+#define KPK_BK(i)  ((square_t)(((i) >> 1) & 0x3f))
+#define KPK_WK(i)  ((square_t)(((i) >> 7) & 0x3f))
+#define KPK_WP(i)  SQUARE(((i) >> 13) & 0x3, RANK_7 - ((i) >> 15))
+
+static uint8_t kpk_bits[KPK_SIZE / 8];
+
+static uint8_t kpk_init(unsigned int index)
+{
+	square_t wk = KPK_WK(index), bk = KPK_BK(index), wp = KPK_WP(index);
+	square_t promotion = wp + 8;
+
+	if ((wk == bk) || (wk == wp) || (bk == wp) ||
+	    (kingattacks[wk] & BB_SQUARE(bk)))
+	{
+		return BITBASE_INVALID;
+	}
+	if (KPK_STM(index) == WHITE)
+	{
+		/* black can't be left in check */
+		if (pawnattacks[WHITE][wp] & BB_SQUARE(bk))
+		{
+			return BITBASE_INVALID;
+		}
+		/* promotes, and the new queen is safe */
+		if ((ROW(wp) == RANK_7) && (promotion != wk) &&
+		    (promotion != bk) &&
+		    (!(kingattacks[bk] & BB_SQUARE(promotion)) ||
+		     (kingattacks[wk] & BB_SQUARE(promotion))))
+		{
+			return BITBASE_WIN;
+		}
+	}
+	/* black takes the pawn */
+	else if ((kingattacks[bk] & BB_SQUARE(wp)) &&
+	         !(kingattacks[wk] & BB_SQUARE(wp)))
+	{
+		return BITBASE_DRAW;
+	}
+	return BITBASE_UNKNOWN;
+}
+
+static int kpk_strongtomove(unsigned int index)
+{
+	return KPK_STM(index) == WHITE;
+}
+
+static int kpk_successors(unsigned int index, unsigned int *succ)
+{
+	square_t wk = KPK_WK(index), bk = KPK_BK(index), wp = KPK_WP(index);
+	bitboard_t targets;
+	square_t square;
+	int n = 0;
+
+	if (KPK_STM(index) == WHITE)
+	{
+		targets = kingattacks[wk] & ~BB_SQUARE(wp);
+		while (targets)
+		{
+			square = BITSCAN(targets);
+			targets ^= BB_SQUARE(square);
+			succ[n++] = KPK_INDEX(BLACK, square, bk, wp);
+		}
+		/* pushes - promoting was taken care of in kpk_init */
+		if ((ROW(wp) < RANK_7) && (wp + 8 != wk) && (wp + 8 != bk))
+		{
+			succ[n++] = KPK_INDEX(BLACK, wk, bk, wp + 8);
+			if ((ROW(wp) == RANK_2) && (wp + 16 != wk) &&
+			    (wp + 16 != bk))
+			{
+				succ[n++] = KPK_INDEX(BLACK, wk, bk, wp + 16);
+			}
+		}
+	}
+	else
+	{
+		/* taking the pawn was taken care of in kpk_init */
+		targets = kingattacks[bk] & ~BB_SQUARE(wp);
+		while (targets)
+		{
+			square = BITSCAN(targets);
+			targets ^= BB_SQUARE(square);
+			succ[n++] = KPK_INDEX(WHITE, wk, square, wp);
+		}
+	}
+	return n;
+}
+
+/* stalemate, either way */
+static uint8_t kpk_nomoves(unsigned int index)
+{
+	(void)index;
+	return BITBASE_DRAW;
+}
+
+static bitbase_ending_t kpk_ending = {
+	KPK_SIZE, kpk_init, kpk_strongtomove, kpk_successors, kpk_nomoves
+};
+
+static char bitbase_initialized = 0;
+
+void bitbase_init()
+{
+	if (bitbase_initialized)
+	{
+		return;
+	}
+	bitbase_generate(&kpk_ending, kpk_bits);
+	bitbase_initialized = 1;
+}
+
+int bitbase_kpk(board_t *board)
+{
+	unsigned char strong = board->pos[WHITE][PAWN] ? WHITE : BLACK;
+	square_t wk = BITSCAN(board->pos[strong][KING]);
+	square_t bk = BITSCAN(board->pos[OTHERCOLOR(strong)][KING]);
+	square_t wp = BITSCAN(board->pos[strong][PAWN]);
+	unsigned int index;
+
+	/* turn the board around so white has the pawn... */
+	if (strong == BLACK)
+	{
+		wk ^= 0x38; bk ^= 0x38; wp ^= 0x38;
+	}
+	/* ...and it's on the queenside */
+	if (COL(wp) > COL_D)
+	{
+		wk ^= 0x7; bk ^= 0x7; wp ^= 0x7;
+	}
+	index = KPK_INDEX((board->tomove == strong) ? WHITE : BLACK, wk, bk, wp);
+	return ((kpk_bits[index >> 3] >> (index & 7)) & 1) ? BITBASE_WIN :
+	                                                      BITBASE_DRAW;
+}
+
+int bitbase_kpk_draw(board_t *board)
+{
+	return (POPCOUNT(board->occupied) == 3) &&
+	       (board->pos[WHITE][PAWN] | board->pos[BLACK][PAWN]) &&
+	       (bitbase_kpk(board) == BITBASE_DRAW);
+}
@@ -0,0 +1,47 @@
+/****************************************************************************
+ * bitbase.h - win/draw tables for tiny endings, solved at startup
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#ifndef BITBASE_H
+#define BITBASE_H
+
+#include "board.h"
+
+/* Results, always for the side with the extra material */
+#define BITBASE_UNKNOWN 0
+#define BITBASE_DRAW    1
+#define BITBASE_WIN     2
+#define BITBASE_INVALID 3
+
+/**
+ * Solve the bitbases. Call once at startup, before any searching.
+ */
+void bitbase_init();
+
+/**
+ * KP vs K: does the side with the pawn win? The board must have exactly the
+ * two kings and one pawn.
+ */
+int bitbase_kpk(board_t *);
+
+/**
+ * Is this a KP vs K position that the bitbase says is drawn? Cheap enough to
+ * ask at every node.
+ */
+int bitbase_kpk_draw(board_t *);
+
+#endif
@@ -18,12 +18,17 @@
  ****************************************************************************/
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include "assert.h"
 #include "board.h"
+#include "eval.h"
 #include "attacks.h"
 #include "bitscan.h"
 #include "rand.h"
+#include "popcnt.h"
+#include "profile.h"
+#include "nnue.h"
 
 /* For FEN conversion, and move->string conversion */
 char *piecename[2][6] = {
@@ -170,12 +175,15 @@ static int rot315squareindex[64] = {
 	63, 62, 60, 57, 53, 48, 42, 35,
 };
 
-/* for material count */
-extern int16_t eval_piecevalue[6];
+/* for the piece/square sums (the piece values come from eval.h) */
+extern int16_t eval_squarevalue[2][6][64];
+extern int16_t eval_squarevalue_endgame[2][6][64];
 
 
 
 #define ZOBRIST_DEFAULT_HASH 0
+/* not 0, which an empty table entry would match */
+#define ZOBRIST_DEFAULT_PAWNHASH BB(0x9e3779b97f4a7c15)
 /* Table of random numbers used to generate the zobrist hash. The indices are
  * first the color (WHITE/BLACK), then the piece type (PAWN-KING), then the
  * square the piece is on (A1-H8) */
@@ -239,7 +247,8 @@ void init_zobrist()
 /**
  * (Re)generate the zobrist hash for a board, store it in board->hash
  * This shouldn't be used every time you change the zobrist, only when
- * initializing the board.
+ * initializing the board. The piece/square sums are recounted here too, and
+ * the network's accumulators and the attack info are marked stale.
  */
 void zobrist_gen(board_t *board)
 {
@@ -250,6 +259,10 @@ void zobrist_gen(board_t *board)
 	int i, j;
 	bitboard_t pos;
 	zobrist_t hash = ZOBRIST_DEFAULT_HASH;
+	zobrist_t pawnhash = ZOBRIST_DEFAULT_PAWNHASH;
+	zobrist_t materialhash = ZOBRIST_DEFAULT_HASH;
+	int16_t squarevalue[2] = { 0, 0 };
+	int16_t squarevalue_endgame[2] = { 0, 0 };
 	
 	if (board == NULL)
 	{
@@ -266,12 +279,27 @@ void zobrist_gen(board_t *board)
 		for (piece = 0; piece < 6; piece++)
 		{
 			pos = board->pos[color][piece];
+			/* the material hash gets the square keys in order,
+			 * one for each piece of this type */
+			for (i = 0; i < POPCOUNT(pos); i++)
+			{
+				materialhash ^= zobrist_piece[color][piece][i];
+			}
 			while (pos)
 			{
 				/* Find the first bit */
 				square = BITSCAN(pos);
 				/* throw in the hash */
 				hash ^= zobrist_piece[color][piece][square];
+				if (piece == PAWN)
+				{
+					pawnhash ^= zobrist_piece[color][piece][square];
+				}
+				squarevalue[color] +=
+					eval_squarevalue[color][piece][square];
+				squarevalue_endgame[color] +=
+					eval_piecevalue_endgame[piece] +
+					eval_squarevalue_endgame[color][piece][square];
 				/* and clear the bit */
 				pos &= BB_ALLEXCEPT(square);
 			}
@@ -298,9 +326,41 @@ void zobrist_gen(board_t *board)
 	}
 
 	board->hash = hash;
+	board->pawnhash = pawnhash;
+	board->materialhash = materialhash;
+	/* the network will have to start over, and so will the attack info */
+	board->accumulator.generation[WHITE] = 0;
+	board->accumulator.generation[BLACK] = 0;
+	board->attacks.valid = 0;
+	for (color = 0; color < 2; color++)
+	{
+		board->squarevalue[color] = squarevalue[color];
+		board->squarevalue_endgame[color] = squarevalue_endgame[color];
+	}
 	return;
 }
 
+/**
+ * Recount the material and the piece/square sums with the eval's current
+ * values, for a board set up before they changed
+ */
+void board_recount(board_t *board)
+{
+	unsigned char color;
+	piece_t piece;
+
+	for (color = 0; color < 2; color++)
+	{
+		board->material[color] = 0;
+		for (piece = 0; piece < 6; piece++)
+		{
+			board->material[color] += eval_piecevalue[piece] *
+			                          POPCOUNT(board->pos[color][piece]);
+		}
+	}
+	zobrist_gen(board);
+}
+
 /****************************************************************************
  * BITBOARD FUNCTIONS
  ****************************************************************************/
@@ -384,6 +444,17 @@ void board_destroy(board_t *board)
 	}
 }
 
+/**
+ * Make an independent copy of a board, e.g. for searching it in another
+ * thread. Free it with board_destroy.
+ */
+board_t *board_copy(board_t *board)
+{
+	board_t *copy = malloc(sizeof(board_t));
+	memcpy(copy, board, sizeof(board_t));
+	return copy;
+}
+
 /**
  * Generates a FEN string for the given position. Free it yourself when you're
  * done with it. This function makes no effort to be fast; you shouldn't be
@@ -470,6 +541,187 @@ char *board_fen(board_t *board)
 	return fen;
 }
 
+/**
+ * Sets up the position from a FEN string (the two move clocks may be left
+ * off, as in EPD). Returns 0 on success, or -1 if the string makes no sense,
+ * in which case the board is left untouched. Like board_fen, this is not
+ * meant to be fast.
+ */
+int board_setfen(board_t *board, char *fen)
+{
+	board_t *new;
+	char *pieces = "PNBRQKpnbrqk";
+	char *c, *p;
+	int row, col;
+	unsigned char color;
+	piece_t piece;
+	int halfmoves, fullmoves;
+
+	if (board == NULL || fen == NULL)
+	{
+		return -1;
+	}
+	new = malloc(sizeof(board_t));
+	memset(new, 0, sizeof(board_t));
+
+	/* piece placement, from a8 across and down to h1 */
+	c = fen;
+	row = 7;
+	col = 0;
+	while (*c && *c != ' ')
+	{
+		if (*c == '/')
+		{
+			if (col != 8 || row == 0)
+			{
+				goto board_setfen_error;
+			}
+			row--;
+			col = 0;
+		}
+		else if (*c >= '1' && *c <= '8')
+		{
+			col += *c - '0';
+		}
+		else if ((p = strchr(pieces, *c)) != NULL)
+		{
+			color = ((p - pieces) < 6) ? WHITE : BLACK;
+			piece = (p - pieces) % 6;
+			if (col > 7)
+			{
+				goto board_setfen_error;
+			}
+			board_togglepiece(new, SQUARE(col,row), color, piece);
+			new->material[color] += eval_piecevalue[piece];
+			col++;
+		}
+		else
+		{
+			goto board_setfen_error;
+		}
+		if (col > 8)
+		{
+			goto board_setfen_error;
+		}
+		c++;
+	}
+	if (row != 0 || col != 8 ||
+	    POPCOUNT(new->pos[WHITE][KING]) != 1 ||
+	    POPCOUNT(new->pos[BLACK][KING]) != 1 ||
+	    ((new->pos[WHITE][PAWN] | new->pos[BLACK][PAWN]) &
+	     (BB_RANK1 | BB_RANK8)))
+	{
+		goto board_setfen_error;
+	}
+
+	/* who has the move */
+	while (*c == ' ') c++;
+	if (*c == 'w')
+	{
+		new->tomove = WHITE;
+	}
+	else if (*c == 'b')
+	{
+		new->tomove = BLACK;
+	}
+	else
+	{
+		goto board_setfen_error;
+	}
+	c++;
+
+	/* castle privileges - only believe the ones the pieces allow */
+	while (*c == ' ') c++;
+	while (*c && *c != ' ')
+	{
+		switch (*c)
+		{
+			case 'K': new->castle[WHITE][KINGSIDE] = 1; break;
+			case 'Q': new->castle[WHITE][QUEENSIDE] = 1; break;
+			case 'k': new->castle[BLACK][KINGSIDE] = 1; break;
+			case 'q': new->castle[BLACK][QUEENSIDE] = 1; break;
+			case '-': break;
+			default: goto board_setfen_error;
+		}
+		c++;
+	}
+	if (!(new->pos[WHITE][KING] & BB_SQUARE(E1)))
+	{
+		new->castle[WHITE][KINGSIDE] = new->castle[WHITE][QUEENSIDE] = 0;
+	}
+	if (!(new->pos[BLACK][KING] & BB_SQUARE(E8)))
+	{
+		new->castle[BLACK][KINGSIDE] = new->castle[BLACK][QUEENSIDE] = 0;
+	}
+	if (!(new->pos[WHITE][ROOK] & BB_SQUARE(H1))) new->castle[WHITE][KINGSIDE] = 0;
+	if (!(new->pos[WHITE][ROOK] & BB_SQUARE(A1))) new->castle[WHITE][QUEENSIDE] = 0;
+	if (!(new->pos[BLACK][ROOK] & BB_SQUARE(H8))) new->castle[BLACK][KINGSIDE] = 0;
+	if (!(new->pos[BLACK][ROOK] & BB_SQUARE(A8))) new->castle[BLACK][QUEENSIDE] = 0;
+	/* no way to know for sure, but a king on its castled square without
+	 * any privileges left has probably been there since castling */
+	new->hascastled[WHITE] =
+		!(new->castle[WHITE][KINGSIDE] || new->castle[WHITE][QUEENSIDE]) &&
+		(new->pos[WHITE][KING] & (BB_SQUARE(G1) | BB_SQUARE(C1)));
+	new->hascastled[BLACK] =
+		!(new->castle[BLACK][KINGSIDE] || new->castle[BLACK][QUEENSIDE]) &&
+		(new->pos[BLACK][KING] & (BB_SQUARE(G8) | BB_SQUARE(C8)));
+
+	/* enpassant square */
+	while (*c == ' ') c++;
+	if (*c == '-')
+	{
+		c++;
+	}
+	else if (c[0] >= 'a' && c[0] <= 'h' &&
+	         c[1] == ((new->tomove == WHITE) ? '6' : '3'))
+	{
+		new->ep = SQUARE(c[0] - 'a', c[1] - '1');
+		c += 2;
+	}
+	else
+	{
+		goto board_setfen_error;
+	}
+
+	/* move clocks, if they're there */
+	halfmoves = 0;
+	fullmoves = 1;
+	sscanf(c, "%d %d", &halfmoves, &fullmoves);
+	if (halfmoves < 0 || halfmoves > 100)
+	{
+		halfmoves = 0;
+	}
+	if (fullmoves < 1 || fullmoves > HISTORY_STACK_SIZE / 4)
+	{
+		fullmoves = 1;
+	}
+	new->halfmoves = halfmoves;
+	new->moves = 2 * (fullmoves - 1) + new->tomove;
+	/* the repetition check looks back halfmoves entries in the history,
+	 * which are all empty (zeroed above) since we don't know them */
+	if (new->moves < new->halfmoves)
+	{
+		new->moves = new->halfmoves;
+	}
+	new->reps = 0;
+
+	zobrist_gen(new);
+	board_regeneratethreatened(new);
+	/* the side that just moved can't have left its king hanging */
+	if (board_colorincheck(new, OTHERCOLOR(new->tomove)))
+	{
+		goto board_setfen_error;
+	}
+
+	memcpy(board, new, sizeof(board_t));
+	free(new);
+	return 0;
+
+board_setfen_error:
+	free(new);
+	return -1;
+}
+
 /**
  * Gets the piece at the given square index. If the square is empty, -1.
  * You should already know that there's a piece there when you call this.
@@ -706,6 +958,76 @@ bitboard_t board_pawnpushesfrom(board_t *board, square_t square, unsigned char c
 	return moves;
 }
 
+/**
+ * Fill in the color's half of the board's attack info: each piece's attacks
+ * one at a time (except the pawns, which go all together), and what they add
+ * up to
+ */
+static void board_buildattacks(board_t *board, unsigned char color)
+{
+	attackinfo_t *info = &board->attacks;
+	bitboard_t position, attacks, all, twice, kingzone;
+	bitboard_t pawns = board->pos[color][PAWN];
+	piece_t piece;
+	square_t square;
+	uint8_t kingzoneattackers;
+
+	kingzone = board->pos[OTHERCOLOR(color)][KING];
+	kingzone |= kingattacks[BITSCAN(kingzone)];
+	/* the pawns all at once, towards each side; a square both sides hit
+	 * is attacked twice */
+	if (color == WHITE)
+	{
+		all = (pawns & ~BB_FILEA) << 7;
+		attacks = (pawns & ~BB_FILEH) << 9;
+	}
+	else
+	{
+		all = (pawns & ~BB_FILEA) >> 9;
+		attacks = (pawns & ~BB_FILEH) >> 7;
+	}
+	twice = all & attacks;
+	all |= attacks;
+	info->bypiece[color][PAWN] = all;
+	kingzoneattackers = 0;
+	for (piece = KNIGHT; piece <= KING; piece++)
+	{
+		info->bypiece[color][piece] = BB(0x0);
+		position = board->pos[color][piece];
+		while (position)
+		{
+			square = BITSCAN(position);
+			position ^= BB_SQUARE(square);
+			attacks = board_attacksfrom(board, square, piece, color);
+			info->from[square] = attacks;
+			info->bypiece[color][piece] |= attacks;
+			twice |= all & attacks;
+			all |= attacks;
+			if ((piece != KING) && (attacks & kingzone))
+			{
+				kingzoneattackers++;
+			}
+		}
+	}
+	info->all[color] = all;
+	info->twice[color] = twice;
+	info->kingzone[color] = kingzoneattackers;
+	info->valid |= 1 << color;
+}
+
+/**
+ * The attack info for the current position, with the given color's half (at
+ * least) up to date. Only as good as long as nothing moves.
+ */
+attackinfo_t *board_attackinfo(board_t *board, unsigned char color)
+{
+	if (!(board->attacks.valid & (1 << color)))
+	{
+		board_buildattacks(board, color);
+	}
+	return &board->attacks;
+}
+
 /**
  * Generates a linkedlist of "legal" moves for the color to play at the given
  * position. The moves are guaranteed legal, with all appropriate flags set,
@@ -723,11 +1045,14 @@ void board_generatemoves(board_t *board, movelist_t *ml)
 	piece_t piece;
 	square_t square;
 	unsigned char color;
+	PROFILE_TIMER(GENERATEMOVES);
 	
 	assert(board);
 	
 	color = board->tomove;
 	movelist_init(ml);
+	/* board_addmoves wants each piece's attacks */
+	board_attackinfo(board, color);
 	/* we only need to do this part once, not once per pawn */
 	if (board->ep)
 	{
@@ -947,7 +1272,8 @@ static void board_addmoves_king(board_t *board, square_t square, unsigned char c
 
 	return;
 }
-/* for non-special-case pieces: knight bishop rook queen. see above comment */
+/* for non-special-case pieces: knight bishop rook queen. see above comment.
+ * the color's attack info has to be up to date */
 static void board_addmoves(board_t *board, square_t square, piece_t piece, unsigned char color,
                            movelist_t *ml)
 {
@@ -958,7 +1284,7 @@ static void board_addmoves(board_t *board, square_t square, piece_t piece, unsig
 	
 	/* find all destination squares -- all attacked squares, but can't
 	 * capture our own pieces */
-	moves = board_attacksfrom(board, square, piece, color) & (~(board->piecesofcolor[color]));
+	moves = board->attacks.from[square] & (~(board->piecesofcolor[color]));
 	/* separate captures from noncaptures */
 	capts = moves & board->piecesofcolor[OTHERCOLOR(color)];
 	moves ^= capts;
@@ -1013,6 +1339,8 @@ void board_generatecaptures(board_t *board, movelist_t *ml)
 	
 	color = board->tomove;
 	movelist_init(ml);
+	/* board_addcaptures wants each piece's attacks */
+	board_attackinfo(board, color);
 	/* same call as in addmoves... ep is always a capture */
 	if (board->ep)
 	{
@@ -1153,7 +1481,7 @@ static void board_addcaptures(board_t *board, square_t square, piece_t piece, un
 	
 	/* find all destination squares -- all attacked squares, but can't
 	 * capture our own pieces */
-	moves = board_attacksfrom(board, square, piece, color) &
+	moves = board->attacks.from[square] &
 	        (~(board->piecesofcolor[color]));
 	/* separate captures from noncaptures */
 	capts = moves & board->piecesofcolor[OTHERCOLOR(color)];
@@ -1179,6 +1507,78 @@ static void board_addcaptures(board_t *board, square_t square, piece_t piece, un
 	return;
 }
 
+/**
+ * Generate the quiet moves that give direct check to the enemy king, for the
+ * first ply of quiescence. We look up which squares each piece type would
+ * have to land on to attack the king (the king's own attack sets, turned
+ * around) and intersect those with the pieces' moves. Discovered checks,
+ * castling and promotions aren't generated, and neither are pushes of passed
+ * pawns because board_generatecaptures already has those.
+ */
+void board_generatechecks(board_t *board, movelist_t *ml)
+{
+	bitboard_t checksquares[5];
+	bitboard_t position, moves, empty;
+	piece_t piece;
+	square_t square, destsquare, kingsquare;
+	unsigned char color;
+	move_t move;
+
+	assert(board);
+
+	color = board->tomove;
+	movelist_init(ml);
+	kingsquare = BITSCAN(board->pos[OTHERCOLOR(color)][KING]);
+	empty = ~(board->occupied);
+
+	checksquares[PAWN]   = pawnattacks[OTHERCOLOR(color)][kingsquare] & empty;
+	checksquares[KNIGHT] = knightattacks[kingsquare] & empty;
+	checksquares[BISHOP] = board_attacksfrom(board, kingsquare, BISHOP, color) &
+	                       empty;
+	checksquares[ROOK]   = board_attacksfrom(board, kingsquare, ROOK, color) &
+	                       empty;
+	checksquares[QUEEN]  = checksquares[BISHOP] | checksquares[ROOK];
+	board_attackinfo(board, color);
+
+	for (piece = 0; piece < 5; piece++)
+	{
+		if (!checksquares[piece])
+		{
+			continue;
+		}
+		position = board->pos[color][piece];
+		while (position)
+		{
+			square = BITSCAN(position);
+			position ^= BB_SQUARE(square);
+			if (piece == PAWN)
+			{
+				if (board_pawnpassed(board, square, color))
+				{
+					continue;
+				}
+				moves = board_pawnpushesfrom(board, square, color);
+			}
+			else
+			{
+				moves = board->attacks.from[square];
+			}
+			moves &= checksquares[piece];
+			while (moves)
+			{
+				destsquare = BITSCAN(moves);
+				moves ^= BB_SQUARE(destsquare);
+				move = (square << MOV_INDEX_SRC) |
+				       (destsquare << MOV_INDEX_DEST) |
+				       (color << MOV_INDEX_COLOR) |
+				       (piece << MOV_INDEX_PIECE);
+				movelist_add(ml, board->attackedby, move);
+			}
+		}
+	}
+	return;
+}
+
 
 /***********************
  * Changing board state
@@ -1195,6 +1595,7 @@ void board_applymove(board_t *board, move_t move)
 	square_t rooksrc, rookdest; /* how the rook moves in castling */
 	square_t epcapture;         /* where a pawn will disappear from */
 	int i;
+	PROFILE_TIMER(APPLYMOVE);
 	
 	/* save history. */
 	history_t *h = &board->history[board->moves];
@@ -1561,7 +1962,8 @@ void board_undomove(board_t *board, move_t move)
  * The togglepiece function is a wrapper to simplify moving pieces around on
  * the board. They modify the bits in the piece-specific position masks, the
  * all-pieces-of-one-color mask, and in the four occupied boards, and adjust
- * the zobrist hash.
+ * the zobrist hashes, the piece/square sums and the network accumulators,
+ * and mark the attack info stale.
  */
 static void board_togglepiece(board_t *board, square_t square,
                               unsigned char color, piece_t piece)
@@ -1583,6 +1985,40 @@ static void board_togglepiece(board_t *board, square_t square,
 	
 	/* adjust the zobrist */
 	board->hash ^= zobrist_piece[color][piece][square];
+	if (piece == PAWN)
+	{
+		board->pawnhash ^= zobrist_piece[color][PAWN][square];
+	}
+	
+	/* piece/square sums and the material hash - did the piece arrive or
+	 * leave? the nth piece of a type has the nth square's key */
+	if (board->pos[color][piece] & BB_SQUARE(square))
+	{
+		board->materialhash ^= zobrist_piece[color][piece]
+			[POPCOUNT(board->pos[color][piece]) - 1];
+		board->squarevalue[color] += eval_squarevalue[color][piece][square];
+		board->squarevalue_endgame[color] +=
+			eval_piecevalue_endgame[piece] +
+			eval_squarevalue_endgame[color][piece][square];
+	}
+	else
+	{
+		board->materialhash ^= zobrist_piece[color][piece]
+			[POPCOUNT(board->pos[color][piece])];
+		board->squarevalue[color] -= eval_squarevalue[color][piece][square];
+		board->squarevalue_endgame[color] -=
+			eval_piecevalue_endgame[piece] +
+			eval_squarevalue_endgame[color][piece][square];
+	}
+	
+	/* and the network's accumulators, if we have one */
+	if (nnue_net != NULL)
+	{
+		nnue_togglepiece(board, square, color, piece);
+	}
+
+	/* the attack info is out of date */
+	board->attacks.valid = 0;
 }
 
 /**
@@ -1600,10 +2036,12 @@ typedef struct {
 #endif
 static regen_entry_t regen_array[REGEN_NUM_BUCKETS];
 
+/* the key is stored xored with the masks, so that an entry torn by another
+ * thread writing it doesn't match (like the trans table) */
 static void regen_add(bitboard_t key, bitboard_t white, bitboard_t black)
 {
 	unsigned long bucket = key % REGEN_NUM_BUCKETS;
-	regen_array[bucket].key = key;
+	regen_array[bucket].key = key ^ white ^ black;
 	regen_array[bucket].white = white;
 	regen_array[bucket].black = black;
 }
@@ -1611,29 +2049,30 @@ static void regen_add(bitboard_t key, bitboard_t white, bitboard_t black)
 static int regen_get(bitboard_t key, bitboard_t *white, bitboard_t *black)
 {
 	unsigned long bucket = key % REGEN_NUM_BUCKETS;
-	if (regen_array[bucket].key == key)
+	bitboard_t w = regen_array[bucket].white;
+	bitboard_t b = regen_array[bucket].black;
+	if ((regen_array[bucket].key ^ w ^ b) == key)
 	{
-		*white = regen_array[bucket].white;
-		*black = regen_array[bucket].black;
+		*white = w;
+		*black = b;
 		return 1;
 	}
 	return 0;
 }
 
-int regen_hits = 0;
-int regen_misses = 0;
+__thread int regen_hits = 0;
+__thread int regen_misses = 0;
 
 /**
  * Regenerate the threatened squares masks for both sides. Should be used when
- * a move is made. Don't use in undomove, use the special stacks instead
+ * a move is made. Don't use in undomove, use the special stacks instead. If
+ * they weren't in the hashtable we build the whole attack info while we're at
+ * it, since that's what the masks are made of.
  */
 static void board_regeneratethreatened(board_t *board)
 {
-	bitboard_t mask;
-	bitboard_t position;
-	piece_t piece;
-	square_t square;
-	
+	PROFILE_TIMER(REGENERATE);
+
 	/* check hashtable */
 	if (regen_get(board->hash,
 		      &board->attackedby[WHITE], &board->attackedby[BLACK]))
@@ -1642,78 +2081,10 @@ static void board_regeneratethreatened(board_t *board)
 		return;
 	}
 
-	/********
-	 * White
-	 ********/
-	mask = BB(0x0);
-	/* pawn threatened can be done for all pawns at once */
-	mask |= board_pawnattacks(board->pos[WHITE][PAWN], WHITE);
-	/* Knights and kings manually inlined */
-	position = board->pos[WHITE][KNIGHT];
-	while (position)
-	{
-		square = BITSCAN(position);
-		position ^= BB_SQUARE(square);
-		mask |= knightattacks[square];
-	}
-	position = board->pos[WHITE][KING];
-	while(position)
-	{
-		square = BITSCAN(position);
-		position ^= BB_SQUARE(square);
-		mask |= kingattacks[square];
-	}
-	/* other piece threatened */
-	for (piece = 2; piece < 5; piece++)
-	{
-		position = board->pos[WHITE][piece];
-		/* keep going until we've found all the pieces */
-		while (position)
-		{
-			/* Find one of the pieces, clear its bit */
-			square = BITSCAN(position);
-			position ^= BB_SQUARE(square);
-			/* Put the attacks from this square in the mask */
-			mask |= board_attacksfrom(board, square, piece, WHITE);
-		}
-	}
-	board->attackedby[WHITE] = mask;
-	/********
-	 * Black
-	 ********/
-	mask = BB(0x0);
-	/* pawn threatened can be done for all pawns at once */
-	mask |= board_pawnattacks(board->pos[BLACK][PAWN], BLACK);
-	/* Knights and kings manually inlined */
-	position = board->pos[BLACK][KNIGHT];
-	while (position)
-	{
-		square = BITSCAN(position);
-		position ^= BB_SQUARE(square);
-		mask |= knightattacks[square];
-	}
-	position = board->pos[BLACK][KING];
-	while(position)
-	{
-		square = BITSCAN(position);
-		position ^= BB_SQUARE(square);
-		mask |= kingattacks[square];
-	}
-	/* other piece threatened */
-	for (piece = 2; piece < 5; piece++)
-	{
-		position = board->pos[BLACK][piece];
-		/* keep going until we've found all the pieces */
-		while (position)
-		{
-			/* Find one of the pieces, clear its bit */
-			square = BITSCAN(position);
-			position ^= BB_SQUARE(square);
-			/* Put the attacks from this square in the mask */
-			mask |= board_attacksfrom(board, square, piece, BLACK);
-		}
-	}
-	board->attackedby[BLACK] = mask;
+	board_buildattacks(board, WHITE);
+	board_buildattacks(board, BLACK);
+	board->attackedby[WHITE] = board->attacks.all[WHITE];
+	board->attackedby[BLACK] = board->attacks.all[BLACK];
 
 	/* save to hashtable */
 	regen_add(board->hash, board->attackedby[WHITE], board->attackedby[BLACK]);
@@ -1739,6 +2110,146 @@ bitboard_t board_pawnattacks(bitboard_t pawns, unsigned char color)
 	}
 }
 
+/**
+ * Values used by the static exchange evaluator. The king has to be worth more
+ * than everything else put together so that it is never "traded".
+ */
+static int16_t see_piecevalue[6] = { 100, 300, 300, 500, 900, 20000 };
+
+/**
+ * Flip a square in all four occupancy bitboards, so the sliding attack lookups
+ * see through (or stop at) it. Only the exchange evaluator uses this; nothing
+ * else about the board is touched, and calling it twice puts things back.
+ */
+static void board_toggleoccupied(board_t *board, square_t square)
+{
+	board->occupied ^= BB_SQUARE(square);
+	board->occupied90 ^= BB_SQUARE(ROT90SQUAREINDEX(square));
+	board->occupied45 ^= BB_SQUARE(ROT45SQUAREINDEX(square));
+	board->occupied315 ^= BB_SQUARE(ROT315SQUAREINDEX(square));
+}
+
+/**
+ * Every piece of either color attacking the given square, against the current
+ * occupancy. Pieces already taken off the occupancy boards are masked out.
+ */
+static bitboard_t board_attackersto(board_t *board, square_t square)
+{
+	bitboard_t diagonal, straight;
+
+	diagonal = board->pos[WHITE][BISHOP] | board->pos[BLACK][BISHOP] |
+	           board->pos[WHITE][QUEEN]  | board->pos[BLACK][QUEEN];
+	straight = board->pos[WHITE][ROOK]   | board->pos[BLACK][ROOK] |
+	           board->pos[WHITE][QUEEN]  | board->pos[BLACK][QUEEN];
+
+	return ((pawnattacks[BLACK][square] & board->pos[WHITE][PAWN]) |
+	        (pawnattacks[WHITE][square] & board->pos[BLACK][PAWN]) |
+	        (knightattacks[square] &
+	         (board->pos[WHITE][KNIGHT] | board->pos[BLACK][KNIGHT])) |
+	        (kingattacks[square] &
+	         (board->pos[WHITE][KING] | board->pos[BLACK][KING])) |
+	        (board_attacksfrom(board, square, BISHOP, 0) & diagonal) |
+	        (board_attacksfrom(board, square, ROOK, 0) & straight)) &
+	       board->occupied;
+}
+
+/**
+ * Static exchange evaluation: the material the side to move expects to win
+ * (or lose, if negative) by making the given capture, if both sides keep
+ * recapturing on the destination square with their least valuable attacker
+ * and may stop whenever continuing would lose. X-rays are found by taking the
+ * capturers off the occupancy boards as they're used; they get put back
+ * before we return, so the board is unchanged.
+ */
+int board_see(board_t *board, move_t move)
+{
+	int gain[32];
+	int depth = 0;
+	square_t dest = MOV_DEST(move);
+	square_t square;
+	unsigned char side = board->tomove;
+	bitboard_t removed, attackers, mine, sliders;
+	piece_t onsquare, piece;
+	attackinfo_t *info;
+
+	/* first capture, which the side to move is committed to */
+	gain[0] = MOV_CAPT(move) ? see_piecevalue[MOV_CAPTPC(move)] : 0;
+	onsquare = MOV_PIECE(move);
+	if (MOV_PROM(move))
+	{
+		gain[0] += see_piecevalue[MOV_PROMPC(move)] - see_piecevalue[PAWN];
+		onsquare = MOV_PROMPC(move);
+	}
+
+	/* nothing of theirs can recapture: the destination isn't attacked,
+	 * and no slider sees through the square we're leaving. an ep capture
+	 * empties another square too, so that one always takes the long way */
+	if (!MOV_EP(move))
+	{
+		info = board_attackinfo(board, OTHERCOLOR(side));
+		sliders = info->bypiece[OTHERCOLOR(side)][BISHOP] |
+		          info->bypiece[OTHERCOLOR(side)][ROOK] |
+		          info->bypiece[OTHERCOLOR(side)][QUEEN];
+		if (!((info->all[OTHERCOLOR(side)] & BB_SQUARE(dest)) ||
+		      (sliders & BB_SQUARE(MOV_SRC(move)))))
+		{
+			return gain[0];
+		}
+	}
+
+	removed = BB_SQUARE(MOV_SRC(move));
+	board_toggleoccupied(board, MOV_SRC(move));
+	if (MOV_EP(move))
+	{
+		/* the captured pawn isn't on the destination square */
+		square = (side == WHITE) ? (dest - 8) : (dest + 8);
+		removed |= BB_SQUARE(square);
+		board_toggleoccupied(board, square);
+	}
+
+	/* recaptures */
+	attackers = board_attackersto(board, dest);
+	while (depth < 31)
+	{
+		side = OTHERCOLOR(side);
+		mine = attackers & board->piecesofcolor[side];
+		if (!mine)
+		{
+			break;
+		}
+		for (piece = PAWN; !(mine & board->pos[side][piece]); piece++);
+		square = BITSCAN(mine & board->pos[side][piece]);
+
+		depth++;
+		gain[depth] = see_piecevalue[onsquare] - gain[depth-1];
+		onsquare = piece;
+
+		removed |= BB_SQUARE(square);
+		board_toggleoccupied(board, square);
+		/* might have uncovered a slider behind it */
+		attackers = board_attackersto(board, dest);
+	}
+
+	/* put the board back */
+	while (removed)
+	{
+		square = BITSCAN(removed);
+		removed ^= BB_SQUARE(square);
+		board_toggleoccupied(board, square);
+	}
+
+	/* negamax the swap list back down; either side may stand pat */
+	while (depth > 0)
+	{
+		if (-gain[depth-1] < gain[depth])
+		{
+			gain[depth-1] = -gain[depth];
+		}
+		depth--;
+	}
+	return gain[0];
+}
+
 /**
  * Is the current position a threefold draw?
  */
@@ -2002,6 +2513,123 @@ static move_t move_checksuicide(board_t *board, move_t move)
 	return move;
 }
 
+/**
+ * Finds the legal move that a move in standard algebraic notation stands for
+ * ("Nbxd7+", "exd8=Q", "O-O"), as EPD test suites write them. Coordinate
+ * notation is understood too. Returns 0 if no legal move, or more than one,
+ * fits the description. Slow, like move_islegal.
+ */
+move_t move_fromsan(board_t *board, char *str)
+{
+	char san[16];
+	char *pieces = "PNBRQK";
+	char *c, *p, *end;
+	movelist_t moves;
+	move_t move, found;
+	char *coord;
+	int len, matches;
+	int castle, srccol, srcrow;
+	piece_t piece, prom;
+	square_t dest;
+	unsigned char color = board->tomove;
+
+	/* the check and annotation marks don't tell us anything */
+	strncpy(san, str, sizeof(san) - 1);
+	san[sizeof(san) - 1] = '\0';
+	len = strlen(san);
+	while (len > 0 && strchr("+#!?", san[len-1]))
+	{
+		san[--len] = '\0';
+	}
+	if (len < 2)
+	{
+		return 0;
+	}
+
+	castle = -1;
+	piece = PAWN;
+	prom = PAWN; /* none */
+	srccol = -1;
+	srcrow = -1;
+	dest = 0;
+	if (!strcmp(san, "O-O-O") || !strcmp(san, "0-0-0"))
+	{
+		castle = QUEENSIDE;
+	}
+	else if (!strcmp(san, "O-O") || !strcmp(san, "0-0"))
+	{
+		castle = KINGSIDE;
+	}
+	else
+	{
+		p = san;
+		end = san + len;
+		if (*p && (c = strchr(pieces, *p)))
+		{
+			piece = c - pieces;
+			p++;
+		}
+		/* promotion, with or without the '=' */
+		if (end - p >= 3 && strchr("NBRQ", end[-1]) &&
+		    (end[-2] == '=' || (end[-2] >= '1' && end[-2] <= '8')))
+		{
+			prom = strchr(pieces, end[-1]) - pieces;
+			end -= (end[-2] == '=') ? 2 : 1;
+		}
+		if (end - p < 2 || end[-2] < 'a' || end[-2] > 'h' ||
+		    end[-1] < '1' || end[-1] > '8')
+		{
+			return 0;
+		}
+		dest = SQUARE(end[-2] - 'a', end[-1] - '1');
+		/* whatever's left is disambiguation and capture marks */
+		for (end -= 2; p < end; p++)
+		{
+			if (*p >= 'a' && *p <= 'h')
+			{
+				srccol = *p - 'a';
+			}
+			else if (*p >= '1' && *p <= '8')
+			{
+				srcrow = *p - '1';
+			}
+			else if (*p != 'x' && *p != ':' && *p != '-')
+			{
+				return 0;
+			}
+		}
+	}
+
+	found = 0;
+	matches = 0;
+	board_generatemoves(board, &moves);
+	while (!movelist_isempty(&moves))
+	{
+		move = movelist_remove_max(&moves);
+		coord = move_tostring(move);
+		if (!strcasecmp(coord, str) ||
+		    ((castle >= 0) ? (MOV_CASTLE(move) &&
+		                      (COL(MOV_DEST(move)) == CASTLE_DEST_COL(castle))) :
+		     (!MOV_CASTLE(move) && (MOV_PIECE(move) == piece) &&
+		      (MOV_DEST(move) == dest) &&
+		      ((srccol < 0) || (COL(MOV_SRC(move)) == srccol)) &&
+		      ((srcrow < 0) || (ROW(MOV_SRC(move)) == srcrow)) &&
+		      (MOV_PROM(move) ? (MOV_PROMPC(move) == prom) : (prom == PAWN)))))
+		{
+			board_applymove(board, move);
+			if (!board_colorincheck(board, color))
+			{
+				found = move;
+				matches++;
+			}
+			board_undomove(board, move);
+		}
+		free(coord);
+	}
+	movelist_destroy(&moves);
+	return (matches == 1) ? found : 0;
+}
+
 /**
  * Returns the string representation of a move in computer-friendly format
  * (that is, "squarename[src]squarename[dest]promotionpiece"). Free the string
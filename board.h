@@ -227,6 +227,35 @@ typedef struct {
 	move_t move;
 } history_t;
 
+/**
+ * Who attacks what, for one position. Built for each side only when someone
+ * asks (board_attackinfo), or along with the attackedby masks when those
+ * aren't in their hash table; any change to the pieces makes it stale.
+ */
+typedef struct {
+	bitboard_t from[64];         /* What the piece on each square attacks
+	                              * (not filled in for pawns) */
+	bitboard_t bypiece[2][6];    /* Squares attacked by COLOR's PIECEs */
+	bitboard_t all[2];           /* ...by any of COLOR's pieces */
+	bitboard_t twice[2];         /* ...by two or more of them */
+	uint8_t kingzone[2];         /* How many of COLOR's pieces (not pawns
+	                              * or the king) attack the squares
+	                              * around the other king */
+	unsigned char valid;         /* Bit COLOR set if COLOR's half is
+	                              * up to date */
+} attackinfo_t;
+
+/**
+ * The first layer of the neural network evaluator, for each side's point of
+ * view. Only means anything if generation matches the loaded network's; see
+ * nnue.c
+ */
+#define NNUE_HALFDIMS 256
+typedef struct {
+	int16_t v[2][NNUE_HALFDIMS];
+	unsigned int generation[2];
+} nnue_accumulator_t;
+
 /****************************************************************************
  * Representation of an entire board state.
  * The pos[][] array represents standard normal-oriented setups, accessed by
@@ -303,6 +332,11 @@ typedef struct {
 	bitboard_t occupied315;
 	/* The zobrist hash key for the current position */
 	zobrist_t hash;
+	/* The same, for the pawns alone - the pawn structure table's key */
+	zobrist_t pawnhash;
+	/* And one for how many of each piece there are (not where) - the
+	 * material table's key */
+	zobrist_t materialhash;
 	/* Stores nonrecomputable state for undo. Index into with ->moves. */
 	history_t history[HISTORY_STACK_SIZE];
 	/* Various flags relating to the current position. Note for the ep
@@ -322,6 +356,14 @@ typedef struct {
 	unsigned char reps;          /* how many times has this position
 	                              * appeared before? if 2, draw */
 	int16_t material[2];         /* keeps track of material; see eval.c */
+	int16_t squarevalue[2];      /* sum of each side's piece/square
+	                              * values, and the same with the endgame
+	                              * tables and piece values below. kept
+	                              * up to date by togglepiece */
+	int16_t squarevalue_endgame[2];
+	nnue_accumulator_t accumulator; /* kept up by togglepiece while a
+	                                 * network is loaded */
+	attackinfo_t attacks;        /* see board_attackinfo */
 } board_t;
 
 /****************************************************************************
@@ -377,10 +419,13 @@ extern bitboard_t bb_passedpawnmask[2][64];
  ****************************************************************************/
 void init_zobrist();
 void zobrist_gen(board_t *);
+void board_recount(board_t *);
 
 board_t *board_init();
 void board_destroy(board_t *);
+board_t *board_copy(board_t *);
 char *board_fen(board_t *);
+int board_setfen(board_t *, char *);
 piece_t board_pieceatsquare(board_t *, square_t, unsigned char *);
 int board_incheck(board_t *);
 int board_colorincheck(board_t *, unsigned char);
@@ -390,15 +435,19 @@ int board_squareisattacked(board_t *, square_t, unsigned char);
 int board_squaresareattacked(board_t *, bitboard_t, unsigned char);
 bitboard_t board_attacksfrom(board_t *, square_t, piece_t, unsigned char);
 bitboard_t board_pawnpushesfrom(board_t *, square_t, unsigned char);
+attackinfo_t *board_attackinfo(board_t *, unsigned char);
 void board_generatemoves(board_t *, movelist_t *);
 void board_generatecaptures(board_t *, movelist_t *);
+void board_generatechecks(board_t *, movelist_t *);
 void board_applymove(board_t *, move_t);
 void board_undomove(board_t *, move_t);
 bitboard_t board_pawnattacks(bitboard_t pawns, unsigned char);
+int board_see(board_t *, move_t);
 int board_threefold_draw(board_t *);
 
 move_t move_fromstring(char *);
 move_t move_islegal(board_t *, char *);
+move_t move_fromsan(board_t *, char *);
 char *move_tostring(move_t);
 
 #endif
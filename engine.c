@@ -20,11 +20,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include "engine.h"
+#include "transposition.h"
 
 #define ENGINE_REPEATED_BUCKETS 127
 
 /* from xboard.c, for printing */
+#define BUF_SIZE 2048
 extern FILE *ttyout;
+extern __thread char outbuf[BUF_SIZE];
 void output(char *);
 
 /**
@@ -37,50 +40,128 @@ engine_t *engine_init(search_fn search)
 	e->search = search;
 	e->time_remaining = 0;
 	e->time_increment = 0;
+	e->move_overhead = ENGINE_MOVE_OVERHEAD;
+	e->movetime = 0;
+	e->depth_limit = 0;
+	e->node_limit = 0;
+	e->nps = 0;
 	e->line[0] = '\0';
 	e->inbook = 1;
+	e->pondering = 0;
 	return e;
 }
 
+/* never plan to think for less than this many milliseconds */
+#define ENGINE_MIN_TIME 10
+
 /**
- * Determine how much time to think based on how much time is left
+ * The limits that don't depend on the clock, for a search that's about to
+ * start
  */
-static unsigned int engine_alloctime(engine_t *e)
+static void engine_setlimits(engine_t *e, search_limits_t *limits)
 {
-	/* allocate the time */
-	unsigned int secs;
+	limits->depth = e->depth_limit;
+	limits->nodes = e->node_limit;
+	limits->nps = e->nps;
+}
+
+/**
+ * Determine how much time to think based on how much time is left. We aim to
+ * use a share of the clock plus the increment, but may run on to three times
+ * that if an iteration is in progress - never more than a third of what's
+ * left, though. With a fixed time per move we just use that. Only sets the
+ * time limits, not the flags.
+ */
+static void engine_alloctime(engine_t *e, search_limits_t *limits)
+{
+	unsigned int overhead, remaining, target, hard;
+
+	/* time counted in nodes doesn't lag */
+	overhead = e->nps ? 0 : e->move_overhead;
+	if (e->movetime)
+	{
+		target = (e->movetime > overhead) ? (e->movetime - overhead) : 0;
+		limits->soft_ms = (target > ENGINE_MIN_TIME) ? target : ENGINE_MIN_TIME;
+		limits->hard_ms = limits->soft_ms;
+		return;
+	}
+	/* what we actually have, after lag */
+	if (e->time_remaining > overhead)
+	{
+		remaining = e->time_remaining - overhead;
+	}
+	else
+	{
+		remaining = 0;
+	}
 	if (e->board->moves > 20)
-		secs = e->time_increment + (e->time_remaining / 30) - 1;
+		target = e->time_increment + (remaining / 30);
 	else
-		secs = e->time_increment + (e->time_remaining / 60) - 1;
-	/* we shouldn't limit the search to less than one second, also in some
-	 * cases we get -1 (i.e. lightning) */
-	return (((signed int)secs) >= 1) ? secs : 1;
+		target = e->time_increment + (remaining / 60);
+	hard = target * 3;
+	if (hard > remaining / 3)
+	{
+		hard = remaining / 3;
+	}
+	/* when the increment is most of our time, don't plan past it */
+	if (target > hard)
+	{
+		target = hard;
+	}
+	limits->soft_ms = (target > ENGINE_MIN_TIME) ? target : ENGINE_MIN_TIME;
+	limits->hard_ms = (hard > ENGINE_MIN_TIME) ? hard : ENGINE_MIN_TIME;
 }
 
 /**
  * Have the engine generate a move for the side to play. String must be freed.
+ * NULL if the search was aborted (see search_interrupt()).
  */
 char *engine_generatemove(engine_t *e)
 {
-	if (e->inbook)
+	search_limits_t limits;
+	move_t move;
+
+	/* if we're still pondering, the opponent played the move we expected
+	 * (else whoever applied their move would have stopped us) - so give
+	 * the ponder search a real time limit and take its answer */
+	if (e->pondering)
 	{
-		move_t move = book_move(e->line, e->board);
-		if (move)
-		{
-			/* book lookup was successful */
-			output("ENGINE: Book lookup successful");
-			return move_tostring(move);
-		}
-		else
+		engine_alloctime(e, &e->ponder_limits);
+		__sync_synchronize();
+		e->ponder_limits.ponder = 0;
+		pthread_join(e->ponder_thread, NULL);
+		board_destroy(e->ponder_board);
+		e->pondering = 0;
+		output("ENGINE: Ponder hit");
+		move = e->ponder_result;
+	}
+	else if (e->inbook && (move = book_move(e->line, e->board)))
+	{
+		/* book lookup was successful */
+		output("ENGINE: Book lookup successful");
+		return move_tostring(move);
+	}
+	else
+	{
+		if (e->inbook)
 		{
 			/* we've left the book lines */
 			output("ENGINE: Leaving opening book lines");
 			e->inbook = 0;
 		}
+		engine_alloctime(e, &limits);
+		engine_setlimits(e, &limits);
+		limits.ponder = 0;
+		limits.stop = 0;
+		move = e->search(e->board, &limits, NULL, NULL);
 	}
-	/* we get here if already out of book or if we just left book */
-	return move_tostring(e->search(e->board, engine_alloctime(e), NULL, NULL));
+	/* the xboard input thread cut us off; the move isn't wanted */
+	if (search_interrupted() == SEARCH_ABORT)
+	{
+		output("ENGINE: Search aborted");
+		return NULL;
+	}
+	return move_tostring(move);
 }
 
 /**
@@ -156,7 +237,181 @@ void engine_destroy(engine_t *e)
 	{
 		return;
 	}
+	engine_ponder_stop(e);
 	board_destroy(e->board);
 	free(e);
 	return;
 }
+
+static void *engine_ponder_thread(void *arg)
+{
+	engine_t *e = (engine_t *)arg;
+	e->ponder_result = e->search(e->ponder_board, &e->ponder_limits,
+	                             NULL, NULL);
+	return NULL;
+}
+
+/**
+ * Start thinking on the opponent's time, if we can guess their reply - it's
+ * the second move of the search's principal variation, or failing that the
+ * trans table's best move for this position. Call right after applying our
+ * own move.
+ */
+void engine_ponder(engine_t *e)
+{
+	trans_data_t data;
+	move_t guess;
+	char *str;
+
+	if (e->pondering || e->inbook)
+	{
+		return;
+	}
+	guess = search_expectedreply();
+	if (!guess)
+	{
+		data = trans_get(e->board->hash);
+		if (!trans_data_valid(data) || !TRANS_MOVE(data))
+		{
+			return;
+		}
+		guess = TRANS_MOVE(data);
+	}
+	/* make sure it's really a move in this position */
+	str = move_tostring(guess);
+	guess = move_islegal(e->board, str);
+	free(str);
+	if (!guess)
+	{
+		return;
+	}
+
+	e->ponder_board = board_copy(e->board);
+	board_applymove(e->ponder_board, guess);
+	if (board_mated(e->ponder_board))
+	{
+		board_destroy(e->ponder_board);
+		return;
+	}
+	e->ponder_move = guess;
+	e->ponder_limits.soft_ms = 0;
+	e->ponder_limits.hard_ms = 0;
+	engine_setlimits(e, &e->ponder_limits);
+	e->ponder_limits.ponder = 1;
+	e->ponder_limits.stop = 0;
+	str = move_tostring(guess);
+	snprintf(outbuf, BUF_SIZE-1, "ENGINE: Pondering on %s", str);
+	output(outbuf);
+	free(str);
+	if (pthread_create(&e->ponder_thread, NULL, engine_ponder_thread, e))
+	{
+		board_destroy(e->ponder_board);
+		return;
+	}
+	e->pondering = 1;
+}
+
+/**
+ * Is the opponent's move (as the string they sent) the one we're pondering
+ * on? Only looks at the move we saved, so it's safe while the search runs.
+ */
+int engine_ponder_expects(engine_t *e, char *str)
+{
+	char *expected;
+	int result;
+
+	if (!e->pondering)
+	{
+		return 0;
+	}
+	expected = move_tostring(e->ponder_move);
+	result = !strcmp(expected, str);
+	free(expected);
+	return result;
+}
+
+/**
+ * Abandon the ponder search, if any. Whatever it stored in the trans table
+ * stays there, which is still good for move ordering later.
+ */
+void engine_ponder_stop(engine_t *e)
+{
+	if (!e->pondering)
+	{
+		return;
+	}
+	e->ponder_limits.stop = 1;
+	pthread_join(e->ponder_thread, NULL);
+	board_destroy(e->ponder_board);
+	e->pondering = 0;
+	output(e->ponder_move ? "ENGINE: Ponder miss" : "ENGINE: Analysis stopped");
+}
+
+/**
+ * Search the current position with no limits, in the ponder thread, until
+ * engine_ponder_stop(). The searcher posts its thinking as it goes; whatever
+ * it stores in the trans table is there for the next position analyzed.
+ */
+void engine_analyze(engine_t *e)
+{
+	if (e->pondering || board_mated(e->board))
+	{
+		return;
+	}
+	e->ponder_board = board_copy(e->board);
+	/* no move to expect; the thread only stops when told to */
+	e->ponder_move = 0;
+	e->ponder_limits.soft_ms = 0;
+	e->ponder_limits.hard_ms = 0;
+	e->ponder_limits.depth = 0;
+	e->ponder_limits.nodes = 0;
+	e->ponder_limits.nps = 0;
+	e->ponder_limits.ponder = 1;
+	e->ponder_limits.stop = 0;
+	output("ENGINE: Analyzing");
+	if (pthread_create(&e->ponder_thread, NULL, engine_ponder_thread, e))
+	{
+		board_destroy(e->ponder_board);
+		return;
+	}
+	e->pondering = 1;
+}
+
+/**
+ * Set up the position from a FEN string, for a game that didn't start from
+ * the opening. Returns -1, leaving the board as it was, if it's no good.
+ */
+int engine_setboard(engine_t *e, char *fen)
+{
+	if (board_setfen(e->board, fen))
+	{
+		return -1;
+	}
+	/* the book only knows games from the start */
+	e->line[0] = '\0';
+	e->inbook = 0;
+	return 0;
+}
+
+/**
+ * Take back the last move played. Returns 0 if there's none to take back -
+ * at the start of the game, or of a position set up from a FEN.
+ */
+int engine_undomove(engine_t *e)
+{
+	move_t move;
+
+	if (e->board->moves == 0)
+	{
+		return 0;
+	}
+	move = e->board->history[e->board->moves - 1].move;
+	if (!move)
+	{
+		return 0;
+	}
+	board_undomove(e->board, move);
+	/* we can't know where in the book we'd be */
+	e->inbook = 0;
+	return 1;
+}
@@ -19,6 +19,7 @@
 #ifndef ENGINE_H
 #define ENGINE_H
 
+#include <pthread.h>
 #include "board.h"
 #include "search.h"
 #include "book.h"
@@ -26,13 +27,41 @@
 
 #define ENGINE_NAME "bistromath"
 
+/* where to look for the network when it's turned on without a file */
+#ifndef ENGINE_NNUE_FILE
+#define ENGINE_NNUE_FILE "nn.nnue"
+#endif
+
+/* milliseconds knocked off every move's thinking time to cover lag between
+ * us and the clock (xboard, the ICS server) */
+#ifndef ENGINE_MOVE_OVERHEAD
+#define ENGINE_MOVE_OVERHEAD 100
+#endif
+
 typedef struct engine_t {
 	board_t *board;
 	search_fn search;
+	/* all in milliseconds */
 	unsigned int time_remaining;
 	unsigned int time_increment;
+	unsigned int move_overhead;
+	/* fixed time per move, instead of the clock; 0 if none */
+	unsigned int movetime;
+	/* extra search limits (see search_limits_t); 0 for none */
+	uint8_t depth_limit;
+	unsigned long node_limit;
+	unsigned int nps;
 	char line[BOOK_LINE_MAX_LENGTH];
 	unsigned char inbook;
+	/* pondering: while the opponent thinks, a thread searches the position
+	 * after the reply we expect from them. analysis uses the same thread,
+	 * with no move expected */
+	unsigned char pondering;
+	pthread_t ponder_thread;
+	board_t *ponder_board;
+	move_t ponder_move;
+	move_t ponder_result;
+	search_limits_t ponder_limits;
 } engine_t;
 
 engine_t *engine_init(search_fn);
@@ -40,5 +69,11 @@ char *engine_generatemove(engine_t *);
 int engine_applymove(engine_t *, char *);
 int engine_checkgameover(engine_t *, char **);
 void engine_destroy(engine_t *);
+void engine_ponder(engine_t *);
+int engine_ponder_expects(engine_t *, char *);
+void engine_ponder_stop(engine_t *);
+void engine_analyze(engine_t *);
+int engine_setboard(engine_t *, char *);
+int engine_undomove(engine_t *);
 
 #endif
@@ -17,21 +17,64 @@
  * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  ****************************************************************************/
 #include <stdio.h>
+#include <string.h>
 #include "eval.h"
 #include "bitscan.h"
 #include "popcnt.h"
 #include "pawnstructure.h"
+#include "material.h"
+#include "nnue.h"
 #include "attacks.h"
+#include "profile.h"
 
 /* endgame starts when both sides have <= LIM_ENDGAME */
 #define EVAL_LIM_ENDGAME  1600
 /* use this limit when no queens on the board */
 #define EVAL_LIM_ENDGAME2 2000
 
-#define EVAL_CASTLE_BONUS 20
-
-int16_t eval_piecevalue[6] = { 100, 300, 300, 500, 900, 0 };
-int16_t eval_piecevalue_endgame[6] = { 125, 300, 300, 550, 1200, 0 };
+/* The weights, in the order of enum eval_param (see eval.h), with the names
+ * eval_setparam() and the parameter files use */
+int16_t eval_params[EVAL_NUM_PARAMS] = {
+	100, 300, 300, 500,  900, 0, /* piece values */
+	125, 300, 300, 550, 1200, 0, /* endgame piece values */
+	20, -20,                     /* bishop pair, knight pair */
+	-25,                         /* blocked pawn */
+	10, 3, 12,                   /* rook open file, sight, on the 7th */
+	32,                          /* outposts */
+	/* king safety */
+	20,                          /* castled */
+	-80, -40,  0,  5,            /* N pawns in front on the 2nd rank */
+	  0,   5, 20, 40,            /* N pawns in front on the 3rd rank */
+	-35, -15,                    /* king file open, adjacent file open */
+	0, 0, -10, -25, -45, -65, -80, -90, /* N pieces attacking around it */
+	/* pawn structure */
+	2, 8, 16, 8,                 /* chain, doubled, isolated, backward */
+	0, 3, 6, 12, 24, 48, 96, 0   /* passed, by rank */
+};
+char *eval_paramnames[EVAL_NUM_PARAMS] = {
+	"pawn_value", "knight_value", "bishop_value", "rook_value",
+	"queen_value", "king_value",
+	"pawn_value_endgame", "knight_value_endgame", "bishop_value_endgame",
+	"rook_value_endgame", "queen_value_endgame", "king_value_endgame",
+	"bishop_pair", "knight_pair",
+	"blocked_pawn",
+	"rook_openfile", "rook_openfile_multiplier", "rook_rank7_multiplier",
+	"outpost_bonus",
+	"castle_bonus",
+	"pawncover_rank2_0", "pawncover_rank2_1", "pawncover_rank2_2",
+	"pawncover_rank2_3",
+	"pawncover_rank3_0", "pawncover_rank3_1", "pawncover_rank3_2",
+	"pawncover_rank3_3",
+	"kingfileopen", "adjacentfileopen",
+	"kingzone_attackers_0", "kingzone_attackers_1", "kingzone_attackers_2",
+	"kingzone_attackers_3", "kingzone_attackers_4", "kingzone_attackers_5",
+	"kingzone_attackers_6", "kingzone_attackers_7",
+	"ps_chain_bonus", "ps_doubled_penalty", "ps_isolated_penalty",
+	"ps_backward_penalty",
+	"ps_passed_bonus_0", "ps_passed_bonus_1", "ps_passed_bonus_2",
+	"ps_passed_bonus_3", "ps_passed_bonus_4", "ps_passed_bonus_5",
+	"ps_passed_bonus_6", "ps_passed_bonus_7"
+};
 
 /* Players get small point bonuses if their pieces are on good squares. If
  * white has a rook on d1, squarevalue[WHITE][ROOK][D1] will be added to
@@ -329,39 +372,13 @@ int16_t eval_squarevalue_endgame[2][6][64] = {
 	}
 };
 
-static int16_t eval_endgame(board_t *);
+static int16_t eval_endgame(board_t *, material_t *, float *);
 
-/* Penalty for trapping the d- e- pawns on 2nd rank, or c-pawn with the knight
- * if there's a pawn on d4 and no pawn on e4 */
-#define EVAL_BLOCKED_PAWN -25
 /* used for pawn-block checking N on c3 with pawns c2 d4 !e4 */
 #define BB_C2D4   (BB_SQUARE(C2) | BB_SQUARE(D4))
 #define BB_C2D4E4 (BB_C2D4 | BB_SQUARE(E4))
 #define BB_C7D5   (BB_SQUARE(C7) | BB_SQUARE(D5))
 #define BB_C7D5E5 (BB_C7D5 | BB_SQUARE(E5))
-/* reward the bishop pair and penalize the knight pair */
-#define EVAL_BISHOP_PAIR 20
-#define EVAL_KNIGHT_PAIR -20
-/* Rooks like to see towards the other end of the board */
-#define EVAL_ROOK_OPENFILE 10
-#define EVAL_ROOK_OPENFILE_MULTIPLIER 3
-/* bonus for having multiple rooks on the 7th - take the number of heavies
- * on the 7th, leftshift this constant by that number */
-#define EVAL_ROOK_RANK7_MULTIPLIER 12
-/* bonus for having a minor piece on an "outpost" - a hole in the opp's pawn
- * structure protected by one of own pawns. */
-#define EVAL_OUTPOST_BONUS 32
-
-/**************
- * King safety
- **************/
-/* Points for having N pawns on rank 2/3 in front of a castled king*/
-static int16_t pawncover_rank2[4] = { -80, -40, 0,   5 };
-static int16_t pawncover_rank3[4] = {   0,   5, 20, 40 };
-/* penalty for having no pawns on king's file */
-#define EVAL_KINGFILEOPEN  -35
-/* penalty for having no pawns on file adjacent to king's file */
-#define EVAL_ADJACENTFILEOPEN -15
 
 /* tropism bonus from one square to another (one square has a piece of given
  * type on it, the other has the enemy king) */
@@ -399,10 +416,178 @@ int eval_isendgame(board_t *board)
 	       (board->material[BLACK] <= EVAL_LIM_ENDGAME2);
 }
 
+/**************
+ * Eval cache
+ **************/
+/* Full evaluations, keyed on the position's zobrist hash. Each entry is one
+ * word: the high bits of the key with the value in the low 16 bits, so it
+ * can't be torn by another thread writing the same bucket, and a collision
+ * just costs us an evaluation. Must be a power of two. */
+#ifndef EVAL_CACHE_NUM_BUCKETS
+#define EVAL_CACHE_NUM_BUCKETS 1048576
+#endif
+#define EVAL_CACHE_VALUE_MASK BB(0xffff)
+static uint64_t evalcache[EVAL_CACHE_NUM_BUCKETS];
+
+__thread int evalcache_hits = 0;
+__thread int evalcache_misses = 0;
+
+/* hascastled isn't part of the zobrist hash, but king safety looks at it */
+#define EVAL_CACHE_CASTLED_WHITE BB(0x6a09e667f3bcc908)
+#define EVAL_CACHE_CASTLED_BLACK BB(0xbb67ae8584caa73b)
+
+static zobrist_t evalcache_key(board_t *board)
+{
+	zobrist_t key = board->hash;
+	if (board->hascastled[WHITE]) { key ^= EVAL_CACHE_CASTLED_WHITE; }
+	if (board->hascastled[BLACK]) { key ^= EVAL_CACHE_CASTLED_BLACK; }
+	return key;
+}
+
+static int16_t eval_full(board_t *, int16_t, int16_t, int *, float *);
+
+/* How the window-aware eval did, for the searcher's statistics: how many
+ * evaluations stopped after each stage, and how many went all the way */
+__thread int eval_stage_exits[EVAL_NUM_STAGES];
+
+int eval_usenetwork(char *filename)
+{
+	int result = 0;
+	if (filename == NULL)
+	{
+		nnue_unload();
+	}
+	else
+	{
+		result = nnue_load(filename);
+	}
+	/* the cached scores are from the other evaluator */
+	memset(evalcache, 0, sizeof(evalcache));
+	return result;
+}
+
+int eval_setparam(char *name, int value)
+{
+	int i;
+	for (i = 0; i < EVAL_NUM_PARAMS; i++)
+	{
+		if (0 == strcmp(name, eval_paramnames[i]))
+		{
+			eval_params[i] = value;
+			/* everything remembered was worked out with the old value */
+			memset(evalcache, 0, sizeof(evalcache));
+			pawnstructure_clear();
+			material_clear();
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int eval_loadparams(char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	char name[64];
+	int value, result = 0;
+
+	if (file == NULL)
+	{
+		return -1;
+	}
+	while (fscanf(file, "%63s %d", name, &value) == 2)
+	{
+		if (eval_setparam(name, value) == -1)
+		{
+			result = -1;
+		}
+	}
+	fclose(file);
+	return result;
+}
+
+void eval_saveparams(FILE *file)
+{
+	int i;
+	for (i = 0; i < EVAL_NUM_PARAMS; i++)
+	{
+		fprintf(file, "%s %d\n", eval_paramnames[i], eval_params[i]);
+	}
+}
+
+int16_t eval_trace(board_t *board, float trace[EVAL_NUM_PARAMS])
+{
+	int exact;
+	int16_t value;
+
+	memset(trace, 0, EVAL_NUM_PARAMS * sizeof(float));
+	value = eval_full(board, -EVAL_NO_BOUND, EVAL_NO_BOUND, &exact, trace);
+	return (board->tomove == WHITE) ? value : -value;
+}
+
 /**
  * Evaluate - return a score for the given position for who's to move
  */
 int16_t eval(board_t *board)
+{
+	return eval_window(board, -EVAL_NO_BOUND, EVAL_NO_BOUND);
+}
+
+/**
+ * Evaluate for a search window - see eval.h. Only exact scores go in the
+ * cache.
+ */
+int16_t eval_window(board_t *board, int16_t alpha, int16_t beta)
+{
+	zobrist_t key;
+	uint64_t *entry;
+	uint64_t stored;
+	int16_t value;
+	int exact;
+	PROFILE_TIMER(EVAL);
+
+	key = evalcache_key(board);
+	entry = &evalcache[key & (EVAL_CACHE_NUM_BUCKETS - 1)];
+	stored = *entry;
+
+	if (!((stored ^ key) & ~EVAL_CACHE_VALUE_MASK))
+	{
+		evalcache_hits++;
+		return (int16_t)(stored & EVAL_CACHE_VALUE_MASK);
+	}
+	evalcache_misses++;
+	value = eval_full(board, alpha, beta, &exact, NULL);
+	if (exact)
+	{
+		*entry = (key & ~EVAL_CACHE_VALUE_MASK) | (uint16_t)value;
+	}
+	return value;
+}
+
+/**
+ * Between stages: can everything still to come, which usually moves the
+ * score by less than margin either way, bring it into the window (white's
+ * point of view)? If not, the score so far is very likely on the same side of
+ * the window as the real one will be, and that's all the caller wanted to
+ * know.
+ */
+static int eval_stage_cutoff(int score, int margin, int lo, int hi)
+{
+	return (score + margin <= lo) || (score - margin >= hi);
+}
+
+/* add n to a parameter's coefficient (from white's point of view) when
+ * tracing; i picks the element of a table */
+#define EVAL_TRACE(p, i, n) \
+	do { if (trace) { trace[EVAL_PARAM_##p + (i)] += (n); } } while (0)
+
+/**
+ * The evaluation proper, for when the cache doesn't have it. It goes in
+ * stages, cheapest first, and stops as soon as the rest of the stages can't
+ * bring the score into the window. *exact says whether it got to the end.
+ * With trace, also fills in the coefficients for eval_trace.
+ */
+static int16_t eval_full(board_t *board, int16_t alpha, int16_t beta,
+                         int *exact, float *trace)
 {
 	int piece, square;
 	bitboard_t piecepos;
@@ -414,28 +599,172 @@ int16_t eval(board_t *board)
 	square_t kingsq_white, kingsq_black; /* where's each king */
 	/* counting pieces/pawns for king safety */
 	int num_pieces;
-	/* holes in <color>'s pawnstructure */
+	/* pawnstructure, and the holes in <color>'s pawnstructure */
+	pawnstructure_t ps;
 	bitboard_t holes_white, holes_black;
+	/* imbalance, draw scaling, known endings */
+	material_t mat;
+	/* the window, from white's point of view */
+	int lo, hi;
+	/* who attacks what */
+	attackinfo_t *attacks;
+	/* what king safety gets scaled by, for tracing */
+	float kscale_white, kscale_black;
+	int n;
 
+	*exact = 1;
+	/* the network, if there is one, replaces all of this (except for
+	 * tracing, which is about the parameters here) */
+	if ((nnue_net != NULL) && (trace == NULL))
+	{
+		return nnue_evaluate(board);
+	}
+
+	material_get(board, &mat);
 	/* use the special endgame evaluator if in the endgame */
 	if (eval_isendgame(board))
 	{
-		return eval_endgame(board);
+		return eval_endgame(board, &mat, trace);
 	}
 
 	/* begin evaluating */
+	if (board->tomove == WHITE)
+	{
+		lo = alpha; hi = beta;
+	}
+	else
+	{
+		lo = -beta; hi = -alpha;
+	}
 	score_white = 0; score_black = 0;
 	ksafety_white = 0; ksafety_black = 0;
 	kingsq_white = BITSCAN(board->pos[WHITE][KING]);
 	kingsq_black = BITSCAN(board->pos[BLACK][KING]);
 	
 	/********************************************************************
-	 * Piece/square tables
+	 * Stage 1: material, piece/square tables (summed up as the pieces
+	 * move) and the material table's imbalance
+	 ********************************************************************/
+	score_white += board->material[WHITE] + board->squarevalue[WHITE] +
+	               mat.imbalance;
+	score_black += board->material[BLACK] + board->squarevalue[BLACK];
+	if (trace)
+	{
+		for (piece = 0; piece < 6; piece++)
+		{
+			EVAL_TRACE(PIECEVALUE, piece,
+			           POPCOUNT(board->pos[WHITE][piece]) -
+			           POPCOUNT(board->pos[BLACK][piece]));
+		}
+		EVAL_TRACE(BISHOP_PAIR, 0,
+		           (POPCOUNT(board->pos[WHITE][BISHOP]) > 1) -
+		           (POPCOUNT(board->pos[BLACK][BISHOP]) > 1));
+		EVAL_TRACE(KNIGHT_PAIR, 0,
+		           (POPCOUNT(board->pos[WHITE][KNIGHT]) > 1) -
+		           (POPCOUNT(board->pos[BLACK][KNIGHT]) > 1));
+	}
+	if (eval_stage_cutoff(score_white - score_black, EVAL_STAGE_MARGIN_MATERIAL,
+	                      lo, hi))
+	{
+		eval_stage_exits[EVAL_STAGE_MATERIAL]++;
+		goto eval_full_partial;
+	}
+
+	/********************************************************************
+	 * Stage 2: pawn structure (usually from the pawn hash) and the other
+	 * pawn-shaped terms
+	 ********************************************************************/
+	/* pawnstructure bonus */
+	if (trace)
+	{
+		eval_pawnstructure_trace(board, &ps, trace);
+	}
+	else
+	{
+		eval_pawnstructure(board, &ps);
+	}
+	score_white += ps.value[WHITE];
+	score_black += ps.value[BLACK];
+	holes_white = ps.holes[WHITE];
+	holes_black = ps.holes[BLACK];
+	/* analysis of pawnstructure holes - all holes that our pawns attack
+	 * and have a minor piece on them get an "outpost" bonus - don't allow
+	 * bonus for outposts on the A and H files */
+	/* find white's outposts */
+	holes_black &= ps.attacks[WHITE] &
+	               (board->pos[WHITE][KNIGHT] | board->pos[WHITE][BISHOP]) &
+	               ~(BB_FILEA | BB_FILEH);
+	score_white += EVAL_PARAM(OUTPOST_BONUS) * POPCOUNT(holes_black);
+	EVAL_TRACE(OUTPOST_BONUS, 0, POPCOUNT(holes_black));
+	/* find black's outposts */
+	holes_white &= ps.attacks[BLACK] &
+	               (board->pos[BLACK][KNIGHT] | board->pos[BLACK][BISHOP]) &
+	               ~(BB_FILEA | BB_FILEH);
+	score_black += EVAL_PARAM(OUTPOST_BONUS) * POPCOUNT(holes_white);
+	EVAL_TRACE(OUTPOST_BONUS, 0, -POPCOUNT(holes_white));
+	/* pawn block penalties */
+	if (((board->piecesofcolor[WHITE] ^ board->pos[WHITE][PAWN]) & BB_SQUARE(D3)) &&
+	    (board->pos[WHITE][PAWN] & BB_SQUARE(D2))) /* blocked on D2 */
+	{
+		score_white += EVAL_PARAM(BLOCKED_PAWN);
+		EVAL_TRACE(BLOCKED_PAWN, 0, 1);
+	}
+	if (((board->piecesofcolor[WHITE] ^ board->pos[WHITE][PAWN]) & BB_SQUARE(E3)) &&
+	    (board->pos[WHITE][PAWN] & BB_SQUARE(E2))) /* blocked on E2 */
+	{
+		score_white += EVAL_PARAM(BLOCKED_PAWN);
+		EVAL_TRACE(BLOCKED_PAWN, 0, 1);
+	}
+	if ((board->pos[WHITE][KNIGHT] & BB_SQUARE(C3)) && /* knight on C3 */
+	    !((board->pos[WHITE][PAWN] ^ BB_C2D4) & BB_C2D4E4)) /* "closed" opening */
+	{
+		score_white += EVAL_PARAM(BLOCKED_PAWN);
+		EVAL_TRACE(BLOCKED_PAWN, 0, 1);
+	}
+	/* black */
+	if (((board->piecesofcolor[BLACK] ^ board->pos[BLACK][PAWN]) & BB_SQUARE(D6)) &&
+	    (board->pos[BLACK][PAWN] & BB_SQUARE(D7))) /* blocked on D7 */
+	{
+		score_black += EVAL_PARAM(BLOCKED_PAWN);
+		EVAL_TRACE(BLOCKED_PAWN, 0, -1);
+	}
+	if (((board->piecesofcolor[BLACK] ^ board->pos[BLACK][PAWN]) & BB_SQUARE(E6)) &&
+	    (board->pos[BLACK][PAWN] & BB_SQUARE(E7))) /* blocked on E7 */
+	{
+		score_black += EVAL_PARAM(BLOCKED_PAWN);
+		EVAL_TRACE(BLOCKED_PAWN, 0, -1);
+	}
+	if ((board->pos[BLACK][KNIGHT] & BB_SQUARE(C6)) && /* knight on C6 */
+	    !((board->pos[BLACK][PAWN] ^ BB_C7D5) & BB_C7D5E5)) /* "closed" defense */
+	{
+		score_black += EVAL_PARAM(BLOCKED_PAWN);
+		EVAL_TRACE(BLOCKED_PAWN, 0, -1);
+	}
+	/* rook/queen on the 7th bonus */
+	n = POPCOUNT((board->pos[WHITE][ROOK] | board->pos[WHITE][QUEEN]) &
+	             BB_RANK7);
+	score_white += EVAL_PARAM(ROOK_RANK7_MULTIPLIER) << n;
+	EVAL_TRACE(ROOK_RANK7_MULTIPLIER, 0, 1 << n);
+	n = POPCOUNT((board->pos[BLACK][ROOK] | board->pos[BLACK][QUEEN]) &
+	             BB_RANK2);
+	score_black += EVAL_PARAM(ROOK_RANK7_MULTIPLIER) << n;
+	EVAL_TRACE(ROOK_RANK7_MULTIPLIER, 0, -(1 << n));
+	
+	if (eval_stage_cutoff(score_white - score_black, EVAL_STAGE_MARGIN_PAWNS,
+	                      lo, hi))
+	{
+		eval_stage_exits[EVAL_STAGE_PAWNS]++;
+		goto eval_full_partial;
+	}
+
+	/********************************************************************
+	 * Stage 3: the pieces one at a time, and king safety
 	 ********************************************************************/
+	attacks = board_attackinfo(board, WHITE);
+	board_attackinfo(board, BLACK);
 	/********
 	 * White
 	 ********/
-	/* regular pieces - pawns taken care of in pawnstructure eval */
 	for (piece = 1; piece < 5; piece++)
 	{
 		piecepos = board->pos[WHITE][piece];
@@ -443,7 +772,6 @@ int16_t eval(board_t *board)
 		{
 			square = BITSCAN(piecepos);
 			piecepos ^= BB_SQUARE(square);
-			score_white += eval_squarevalue[WHITE][piece][square];
 			/* tropism scores - how close is to our/opp king? */
 			//ksafety_white += tropism(square, kingsq_white, piece);
 			ksafety_black -= tropism(square, kingsq_black, piece);
@@ -453,16 +781,16 @@ int16_t eval(board_t *board)
 				/* no pawns on this file */
 				if (!(board->pos[WHITE][PAWN] & BB_FILE(COL(square))))
 				{
-					score_white += EVAL_ROOK_OPENFILE;
+					score_white += EVAL_PARAM(ROOK_OPENFILE);
+					EVAL_TRACE(ROOK_OPENFILE, 0, 1);
 				}
 				/* how far can we see? */
-				score_white += EVAL_ROOK_OPENFILE_MULTIPLIER * POPCOUNT(colattacks[(board->occupied90 >> (8 * COL(square))) & 0xFF][ROW(square)]);
+				n = POPCOUNT(attacks->from[square] & BB_FILE(COL(square)));
+				score_white += EVAL_PARAM(ROOK_OPENFILE_MULTIPLIER) * n;
+				EVAL_TRACE(ROOK_OPENFILE_MULTIPLIER, 0, n);
 			}
 		}
 	}
-	/* king */
-	score_white += eval_squarevalue[WHITE][KING][kingsq_white];
-	
 	/********
 	 * Black
 	 ********/
@@ -473,7 +801,6 @@ int16_t eval(board_t *board)
 		{
 			square = BITSCAN(piecepos);
 			piecepos ^= BB_SQUARE(square);
-			score_black += eval_squarevalue[BLACK][piece][square];
 			/* tropism scores - how close is to our/opp king? */
 			ksafety_white -= tropism(square, kingsq_white, piece);
 			//ksafety_black += tropism(square, kingsq_black, piece);
@@ -483,100 +810,41 @@ int16_t eval(board_t *board)
 				/* no pawns on this file */
 				if (!(board->pos[BLACK][PAWN] & BB_FILE(COL(square))))
 				{
-					score_black += EVAL_ROOK_OPENFILE;
+					score_black += EVAL_PARAM(ROOK_OPENFILE);
+					EVAL_TRACE(ROOK_OPENFILE, 0, -1);
 				}
 				/* how far can we see? */
-				score_black += EVAL_ROOK_OPENFILE_MULTIPLIER * POPCOUNT(colattacks[(board->occupied90 >> (8 * COL(square))) & 0xFF][ROW(square)]);
+				n = POPCOUNT(attacks->from[square] & BB_FILE(COL(square)));
+				score_black += EVAL_PARAM(ROOK_OPENFILE_MULTIPLIER) * n;
+				EVAL_TRACE(ROOK_OPENFILE_MULTIPLIER, 0, -n);
 			}
 		}
 	}
-	/* king */
-	score_black += eval_squarevalue[BLACK][KING][kingsq_white];
-	
-	/********************************************************************
-	 * Misc. bonuses
-	 ********************************************************************/
-	/* bishop/knight pair bonus/penalties */
-	if (POPCOUNT(board->pos[WHITE][BISHOP]) > 1) { score_white += EVAL_BISHOP_PAIR; }
-	if (POPCOUNT(board->pos[WHITE][KNIGHT]) > 1) { score_white += EVAL_KNIGHT_PAIR; }
-	if (POPCOUNT(board->pos[BLACK][BISHOP]) > 1) { score_black += EVAL_BISHOP_PAIR; }
-	if (POPCOUNT(board->pos[BLACK][KNIGHT]) > 1) { score_black += EVAL_KNIGHT_PAIR; }
-	/* pawnstructure bonus */
-	score_white += eval_pawnstructure(board, WHITE, &holes_white);
-	score_black += eval_pawnstructure(board, BLACK, &holes_black);
-	/* analysis of pawnstructure holes - all holes that our pawns attack
-	 * and have a minor piece on them get an "outpost" bonus - don't allow
-	 * bonus for outposts on the A and H files */
-	/* find white's outposts */
-	holes_black &= board_pawnattacks(board->pos[WHITE][PAWN], WHITE) &
-	               (board->pos[WHITE][KNIGHT] | board->pos[WHITE][BISHOP]) &
-	               ~(BB_FILEA | BB_FILEH);
-	score_white += EVAL_OUTPOST_BONUS * POPCOUNT(holes_black);
-	/* find black's outposts */
-	holes_white &= board_pawnattacks(board->pos[BLACK][PAWN], BLACK) &
-	               (board->pos[BLACK][KNIGHT] | board->pos[BLACK][BISHOP]) &
-	               ~(BB_FILEA | BB_FILEH);
-	score_black += EVAL_OUTPOST_BONUS * POPCOUNT(holes_white);
-	/* pawn block penalties */
-	if (((board->piecesofcolor[WHITE] ^ board->pos[WHITE][PAWN]) & BB_SQUARE(D3)) &&
-	    (board->pos[WHITE][PAWN] & BB_SQUARE(D2))) /* blocked on D2 */
-	{
-		score_white += EVAL_BLOCKED_PAWN;
-	}
-	if (((board->piecesofcolor[WHITE] ^ board->pos[WHITE][PAWN]) & BB_SQUARE(E3)) &&
-	    (board->pos[WHITE][PAWN] & BB_SQUARE(E2))) /* blocked on E2 */
-	{
-		score_white += EVAL_BLOCKED_PAWN;
-	}
-	if ((board->pos[WHITE][KNIGHT] & BB_SQUARE(C3)) && /* knight on C3 */
-	    !((board->pos[WHITE][PAWN] ^ BB_C2D4) & BB_C2D4E4)) /* "closed" opening */
-	{
-		score_white += EVAL_BLOCKED_PAWN;
-	}
-	/* black */
-	if (((board->piecesofcolor[BLACK] ^ board->pos[BLACK][PAWN]) & BB_SQUARE(D6)) &&
-	    (board->pos[BLACK][PAWN] & BB_SQUARE(D7))) /* blocked on D7 */
-	{
-		score_black += EVAL_BLOCKED_PAWN;
-	}
-	if (((board->piecesofcolor[BLACK] ^ board->pos[BLACK][PAWN]) & BB_SQUARE(E6)) &&
-	    (board->pos[BLACK][PAWN] & BB_SQUARE(E7))) /* blocked on E7 */
-	{
-		score_black += EVAL_BLOCKED_PAWN;
-	}
-	if ((board->pos[BLACK][KNIGHT] & BB_SQUARE(C6)) && /* knight on C6 */
-	    !((board->pos[BLACK][PAWN] ^ BB_C7D5) & BB_C7D5E5)) /* "closed" defense */
-	{
-		score_black += EVAL_BLOCKED_PAWN;
-	}
-	/* rook/queen on the 7th bonus */
-	score_white += EVAL_ROOK_RANK7_MULTIPLIER <<
-	               POPCOUNT((board->pos[WHITE][ROOK] | board->pos[WHITE][QUEEN]) &
-	                        BB_RANK7);
-	score_black += EVAL_ROOK_RANK7_MULTIPLIER <<
-	               POPCOUNT((board->pos[BLACK][ROOK] | board->pos[BLACK][QUEEN]) &
-	                        BB_RANK2);
-	
 	/********************************************************************
 	 * King safety - white
 	 ********************************************************************/
+	kscale_white = (float)board->material[BLACK] / 3100;
 	/* pawn shield */
 	if (board->hascastled[WHITE])
 	{
-		ksafety_white += EVAL_CASTLE_BONUS;
+		ksafety_white += EVAL_PARAM(CASTLE_BONUS);
+		EVAL_TRACE(CASTLE_BONUS, 0, kscale_white);
 		/* pawn shield one row in front of the king */
 		num_pieces = POPCOUNT(kingattacks[kingsq_white] &
 		                    board->pos[WHITE][PAWN] & BB_RANK2);
-		ksafety_white += pawncover_rank2[num_pieces];
+		ksafety_white += eval_params[EVAL_PARAM_PAWNCOVER_RANK2 + num_pieces];
+		EVAL_TRACE(PAWNCOVER_RANK2, num_pieces, kscale_white);
 		/* pawn shield two rows in front of the king */
 		num_pieces = POPCOUNT(kingattacks[kingsq_white + 8] &
 		                    board->pos[WHITE][PAWN] & BB_RANK3);
-		ksafety_white += pawncover_rank3[num_pieces];
+		ksafety_white += eval_params[EVAL_PARAM_PAWNCOVER_RANK3 + num_pieces];
+		EVAL_TRACE(PAWNCOVER_RANK3, num_pieces, kscale_white);
 	}
 	/* open files near the king */
 	if (!(board->pos[WHITE][PAWN] & BB_FILE(COL(kingsq_white))))
 	{
-		ksafety_white += EVAL_KINGFILEOPEN;
+		ksafety_white += EVAL_PARAM(KINGFILEOPEN);
+		EVAL_TRACE(KINGFILEOPEN, 0, kscale_white);
 	}
 	switch(COL(kingsq_white)) /* this idea taken from gnuchess */
 	{
@@ -586,7 +854,8 @@ int16_t eval(board_t *board)
 		case COL_G:
 			if (!(board->pos[WHITE][PAWN] & BB_FILE(COL(kingsq_white) + 1)))
 			{
-				ksafety_white += EVAL_ADJACENTFILEOPEN;
+				ksafety_white += EVAL_PARAM(ADJACENTFILEOPEN);
+				EVAL_TRACE(ADJACENTFILEOPEN, 0, kscale_white);
 			}
 			break;
 		case COL_H:
@@ -595,33 +864,43 @@ int16_t eval(board_t *board)
 		case COL_B:
 			if (!(board->pos[WHITE][PAWN] & BB_FILE(COL(kingsq_white) - 1)))
 			{
-				ksafety_white += EVAL_ADJACENTFILEOPEN;
+				ksafety_white += EVAL_PARAM(ADJACENTFILEOPEN);
+				EVAL_TRACE(ADJACENTFILEOPEN, 0, kscale_white);
 			}
 			break;
 		default:
 			break;
 	}
+	/* enemy pieces bearing down on the king */
+	n = (attacks->kingzone[BLACK] > 7) ? 7 : attacks->kingzone[BLACK];
+	ksafety_white += eval_params[EVAL_PARAM_KINGZONE_ATTACKERS + n];
+	EVAL_TRACE(KINGZONE_ATTACKERS, n, kscale_white);
 	score_white += ksafety_white * board->material[BLACK] / 3100;
 	/********************************************************************
 	 * King safety - black
 	 ********************************************************************/
+	kscale_black = -(float)board->material[WHITE] / 3100;
 	/* pawn shield */
 	if (board->hascastled[BLACK])
 	{
-		ksafety_black += EVAL_CASTLE_BONUS;
+		ksafety_black += EVAL_PARAM(CASTLE_BONUS);
+		EVAL_TRACE(CASTLE_BONUS, 0, kscale_black);
 		/* pawn shield one row in front of the king */
 		num_pieces = POPCOUNT(kingattacks[kingsq_black] &
 		                    board->pos[BLACK][PAWN] & BB_RANK7);
-		ksafety_black += pawncover_rank2[num_pieces];
+		ksafety_black += eval_params[EVAL_PARAM_PAWNCOVER_RANK2 + num_pieces];
+		EVAL_TRACE(PAWNCOVER_RANK2, num_pieces, kscale_black);
 		/* pawn shield two rows in front of the king */
 		num_pieces = POPCOUNT(kingattacks[kingsq_black - 8] &
 		                    board->pos[BLACK][PAWN] & BB_RANK6);
-		ksafety_black += pawncover_rank3[num_pieces];
+		ksafety_black += eval_params[EVAL_PARAM_PAWNCOVER_RANK3 + num_pieces];
+		EVAL_TRACE(PAWNCOVER_RANK3, num_pieces, kscale_black);
 	}
 	/* open files near the king */
 	if (!(board->pos[BLACK][PAWN] & BB_FILE(COL(kingsq_black))))
 	{
-		ksafety_black += EVAL_KINGFILEOPEN;
+		ksafety_black += EVAL_PARAM(KINGFILEOPEN);
+		EVAL_TRACE(KINGFILEOPEN, 0, kscale_black);
 	}
 	switch(COL(kingsq_black)) /* this idea taken from gnuchess */
 	{
@@ -631,7 +910,8 @@ int16_t eval(board_t *board)
 		case COL_G:
 			if (!(board->pos[BLACK][PAWN] & BB_FILE(COL(kingsq_black) + 1)))
 			{
-				ksafety_black += EVAL_ADJACENTFILEOPEN;
+				ksafety_black += EVAL_PARAM(ADJACENTFILEOPEN);
+				EVAL_TRACE(ADJACENTFILEOPEN, 0, kscale_black);
 			}
 			break;
 		case COL_H:
@@ -640,271 +920,84 @@ int16_t eval(board_t *board)
 		case COL_B:
 			if (!(board->pos[BLACK][PAWN] & BB_FILE(COL(kingsq_black) - 1)))
 			{
-				ksafety_black += EVAL_ADJACENTFILEOPEN;
+				ksafety_black += EVAL_PARAM(ADJACENTFILEOPEN);
+				EVAL_TRACE(ADJACENTFILEOPEN, 0, kscale_black);
 			}
 			break;
 		default:
 			break;
 	}
+	/* enemy pieces bearing down on the king */
+	n = (attacks->kingzone[WHITE] > 7) ? 7 : attacks->kingzone[WHITE];
+	ksafety_black += eval_params[EVAL_PARAM_KINGZONE_ATTACKERS + n];
+	EVAL_TRACE(KINGZONE_ATTACKERS, n, kscale_black);
 	score_black += ksafety_black * board->material[WHITE] / 3100;
+	eval_stage_exits[EVAL_STAGE_FULL]++;
+	goto eval_full_return;
+
+eval_full_partial:
+	*exact = 0;
+eval_full_return:
 	/********************************************************************
 	 * return the values
 	 ********************************************************************/
 	if (board->tomove == WHITE)
 	{
-		return (score_white + board->material[WHITE]) -
-		       (score_black + board->material[BLACK]);
+		return score_white - score_black;
 	}
 	else
 	{
-		return (score_black + board->material[BLACK]) -
-		       (score_white + board->material[WHITE]);
+		return score_black - score_white;
 	}
 }
 
 /**
- * Special-case endgame evaluator
+ * Special-case endgame evaluator - the material table knows which endings
+ * are drawn and which ones need their own evaluator
  */
-static int16_t eval_endgame(board_t *board)
+static int16_t eval_endgame(board_t *board, material_t *mat, float *trace)
 {
-	int piece, square;
-	bitboard_t piecepos;
-	/* keeps track of {WHITE,BLACK}s score */
-	int16_t score_white = 0, score_black = 0;
-	int16_t difference = board->material[WHITE] -
-	                 board->material[BLACK];
-	
-	/* draw evaluation - if no pawns are left, many possibilities
-	 * note, our goal in this if block is to put the conditionals most
-	 * likely to fail first, so we don't waste time saying "is the pawn's
-	 * promotion square the opposite color of the bishop" when there's a
-	 * queen on the board. */
-	if (!(board->pos[WHITE][PAWN] | board->pos[BLACK][PAWN]))
-	{
-		/* absolute value */
-		if (difference < 0) { difference = -difference; }
-		
-		/* a good heuristic to use is if the material difference is
-		 * less than 400, the position is drawn */
-		if (difference < 400)
-		{
-			return 0;
-		}
+	int16_t value;
+	piece_t piece;
+	int scale;
 
-		/* KNN vs K */
-		else if (difference == 600)
-		{
-			/* check if white has the two knights */
-			if ((board->material[BLACK] == 0) &&
-			    (board->piecesofcolor[WHITE] ==
-			     (board->pos[WHITE][KING] |
-			      board->pos[WHITE][KNIGHT])))
-			{
-				return 0;
-			}
-			/* or black has the two knights */
-			if ((board->material[WHITE] == 0) &&
-			    (board->piecesofcolor[BLACK] ==
-			     (board->pos[BLACK][KING] |
-			      board->pos[BLACK][KNIGHT])))
-			{
-				return 0;
-			}
-			/* here it must be a different piece configuration */
-		}
-	}
-	/* KB + wrong color rook pawn vs K */
-	else if (difference == 400)
+	if (mat->evaluator != NULL)
 	{
-		/* first make sure it's KB rookpawn v K */
-		if ((board->material[BLACK] == 0) &&
-		    (board->pos[WHITE][BISHOP] != BB(0x0)) &&
-		    (board->pos[WHITE][PAWN] & (COL_A | COL_H)))
-		{
-			square_t pawnsquare = BITSCAN(board->pos[WHITE][PAWN]);
-			square_t bishopsquare = BITSCAN(board->pos[WHITE][BISHOP]);
-			square_t promotionsquare = SQUARE(COL(pawnsquare),RANK_8);
-			/* check the square parities and also where's
-			 * the enemy king */
-			if ((PARITY(bishopsquare) != PARITY(promotionsquare)) &&
-			    (kingattacks[BITSCAN(board->pos[BLACK][KING])] &
-			     BB_SQUARE(promotionsquare)))
-			{
-				return 0;
-			}
-		}
-		/* same thing for the other color */
-		else if ((board->material[WHITE] == 0) &&
-		         (board->pos[BLACK][BISHOP] != BB(0x0)) &&
-		         (board->pos[BLACK][PAWN] & (COL_A | COL_H)))
-		{
-			square_t pawnsquare = BITSCAN(board->pos[BLACK][PAWN]);
-			square_t bishopsquare = BITSCAN(board->pos[BLACK][BISHOP]);
-			square_t promotionsquare = SQUARE(COL(pawnsquare),RANK_1);
-			/* check the square parities and also where's
-			 * the enemy king */
-			if ((PARITY(bishopsquare) != PARITY(promotionsquare)) &&
-			    (kingattacks[BITSCAN(board->pos[WHITE][KING])] &
-			     BB_SQUARE(promotionsquare)))
-			{
-				return 0;
-			}
-		}
+		value = mat->evaluator(board);
 	}
-	/* KP vs K - here we code just two cases, to facilitate the searcher;
-	 * once we hit the back rank the searcher will see the draw itself.
-	 * the first position is with the Ks in opposition with the pawn
-	 * in between (either side to move, it's a draw); the second is
-	 * with the pawn behind the winning king, in opposition (zugzwang) */
-	else if (difference == 100)
-	{
-		/* white has the pawn */
-		if (board->material[BLACK] == 0)
-		{
-			square_t whiteking = BITSCAN(board->pos[WHITE][KING]);
-			square_t blackking = BITSCAN(board->pos[BLACK][KING]);
-			square_t whitepawn = BITSCAN(board->pos[WHITE][PAWN]);
-			unsigned char pawncol = COL(whitepawn);
-			/* test for rook pawn draws */
-			if (pawncol == COL_A || pawncol == COL_H)
-			{
-				/* if black king gets in front of the pawn,
-				 * it's a draw no matter what */
-				if ((COL(blackking) == pawncol) &&
-				    (blackking > whitepawn))
-				{
-					return 0;
-				}
-				/* if the white king is in front of his pawn,
-				 * but trapped by the black king, it'll end in
-				 * stalemate */
-				if (COL(whiteking) == pawncol)
-				{
-					if (pawncol == COL_A)
-					{
-						if (blackking - whiteking == 2)
-						{
-							return 0;
-						}
-					}
-					else /* pawncol == COL_H */
-					{
-						if (whiteking - blackking == 2)
-						{
-							return 0;
-						}
-					}
-				}
-			}
-			if ((blackking - whiteking == 16) &&
-			    (ROW(blackking) != RANK_8))
-			{
-				if (whitepawn - whiteking == 8)
-				{
-					return 0;
-				}
-				else if ((whiteking - whitepawn == 8) &&
-					 (board->tomove == WHITE))
-				{
-					return 0;
-				}
-			}	
-		}
-		/* black has the pawn */
-		else if (board->material[WHITE] == 0)
-		{
-			square_t whiteking = BITSCAN(board->pos[WHITE][KING]);
-			square_t blackking = BITSCAN(board->pos[BLACK][KING]);
-			square_t blackpawn = BITSCAN(board->pos[BLACK][PAWN]);
-			unsigned char pawncol = COL(blackpawn);
-			/* test for rook pawn draws */
-			if (pawncol == COL_A || pawncol == COL_H)
-			{
-				/* if black king gets in front of the pawn,
-				 * it's a draw no matter what */
-				if ((COL(whiteking) == pawncol) &&
-				    (whiteking < blackpawn))
-				{
-					return 0;
-				}
-				/* if the white king is in front of his pawn,
-				 * but trapped by the black king, it'll end in
-				 * stalemate */
-				if (COL(blackking) == pawncol)
-				{
-					if (pawncol == COL_A)
-					{
-						if (whiteking - blackking == 2)
-						{
-							return 0;
-						}
-					}
-					else /* pawncol == COL_H */
-					{
-						if (blackking - whiteking== 2)
-						{
-							return 0;
-						}
-					}
-				}
-			}
-			if ((blackking - whiteking == 16) &&
-			    (ROW(whiteking) != RANK_1))
-			{
-				if (blackking - blackpawn == 8)
-				{
-					return 0;
-				}
-				else if ((blackpawn - blackking == 8) &&
-					 (board->tomove == BLACK))
-				{
-					return 0;
-				}
-			}	
-		}
-	}
-	
-	/* calculate piece/square totals */
-	for (piece = 0; piece < 6; piece++)
-	{
-		piecepos = board->pos[WHITE][piece];
-		while (piecepos)
-		{
-			square = BITSCAN(piecepos);
-			piecepos ^= BB_SQUARE(square);
-			score_white += eval_piecevalue_endgame[piece] +
-			               eval_squarevalue_endgame[WHITE][piece][square];
-		}
-	}
-	for (piece = 0; piece < 6; piece++)
+	else
 	{
-		piecepos = board->pos[BLACK][piece];
-		while (piecepos)
+		/* the piece/square totals - we revalued the pieces to make
+		 * pawns more important so board->material is inaccurate */
+		value = board->squarevalue_endgame[WHITE] -
+		        board->squarevalue_endgame[BLACK];
+		scale = mat->scale[(value > 0) ? WHITE : BLACK];
+		value = value * scale / MATERIAL_SCALE_NORMAL;
+		for (piece = 0; trace && (piece < 6); piece++)
 		{
-			square = BITSCAN(piecepos);
-			piecepos ^= BB_SQUARE(square);
-			score_black += eval_piecevalue_endgame[piece] +
-			               eval_squarevalue_endgame[BLACK][piece][square];
+			EVAL_TRACE(PIECEVALUE_ENDGAME, piece,
+			           (float)(POPCOUNT(board->pos[WHITE][piece]) -
+			                   POPCOUNT(board->pos[BLACK][piece])) *
+			           scale / MATERIAL_SCALE_NORMAL);
 		}
 	}
-	
-	/* return the values - we revalued the pieces to make pawns more
-	 * important so board->material is inaccurate here */
-	if (board->tomove == WHITE)
-	{
-		return score_white - score_black;
-	}
-	else
-	{
-		return score_black - score_white;
-	}
+	return (board->tomove == WHITE) ? value : -value;
 }
 
 /**
- * Lazy evaluator
+ * Lazy evaluator - the material and piece/square tables, which the board
+ * keeps summed up for us. In the endgame that's all eval_endgame looks at
+ * besides its draw cases.
  */
 int16_t eval_lazy(board_t *board)
 {
-	return board->material[board->tomove] -
-	       board->material[OTHERCOLOR(board->tomove)];
+	unsigned char color = board->tomove;
+	if (eval_isendgame(board))
+	{
+		return board->squarevalue_endgame[color] -
+		       board->squarevalue_endgame[OTHERCOLOR(color)];
+	}
+	return (board->material[color] + board->squarevalue[color]) -
+	       (board->material[OTHERCOLOR(color)] +
+	        board->squarevalue[OTHERCOLOR(color)]);
 }
@@ -19,12 +19,74 @@
 #ifndef EVAL_H
 #define EVAL_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include "board.h"
 
-#ifndef EVAL_LAZY_THRESHHOLD
-#define EVAL_LAZY_THRESHHOLD 250
+/* The eval goes in stages, and after each one checks whether what the rest
+ * of them could add might still bring the score into the caller's window.
+ * The margins are how much we expect them to add, either way - almost
+ * always enough, but they can add more */
+#define EVAL_STAGE_MATERIAL 0 /* material, piece/square tables */
+#define EVAL_STAGE_PAWNS    1 /* pawn structure, outposts, blocked pawns */
+#define EVAL_STAGE_FULL     2 /* pieces and king safety - the whole thing */
+#define EVAL_NUM_STAGES     3
+#ifndef EVAL_STAGE_MARGIN_MATERIAL
+#define EVAL_STAGE_MARGIN_MATERIAL 250
 #endif
+#ifndef EVAL_STAGE_MARGIN_PAWNS
+#define EVAL_STAGE_MARGIN_PAWNS 250
+#endif
+
+/* a window that never cuts the eval short */
+#define EVAL_NO_BOUND 32767
+
+/**
+ * The eval's weights, changeable at runtime (and fit to games by tune.c).
+ * Tables take up one entry per element. Penalties are negative, except the
+ * pawn structure ones, which get subtracted.
+ */
+enum eval_param {
+	/* piece values, by piece, then the same for the endgame */
+	EVAL_PARAM_PIECEVALUE,
+	EVAL_PARAM_PIECEVALUE_ENDGAME = EVAL_PARAM_PIECEVALUE + 6,
+	/* bishop/knight pairs, from the material table */
+	EVAL_PARAM_BISHOP_PAIR = EVAL_PARAM_PIECEVALUE_ENDGAME + 6,
+	EVAL_PARAM_KNIGHT_PAIR,
+	/* d/e pawns stuck behind a piece, or the c pawn behind a knight */
+	EVAL_PARAM_BLOCKED_PAWN,
+	/* rooks on files without our pawns, and per square they see along it */
+	EVAL_PARAM_ROOK_OPENFILE,
+	EVAL_PARAM_ROOK_OPENFILE_MULTIPLIER,
+	/* shifted left by the number of rooks and queens on the 7th */
+	EVAL_PARAM_ROOK_RANK7_MULTIPLIER,
+	/* a minor piece in a hole in their pawns, protected by ours */
+	EVAL_PARAM_OUTPOST_BONUS,
+	/* king safety: castled, N pawns in front of the castled king on the
+	 * 2nd and 3rd ranks, open files, and N pieces attacking around it */
+	EVAL_PARAM_CASTLE_BONUS,
+	EVAL_PARAM_PAWNCOVER_RANK2,
+	EVAL_PARAM_PAWNCOVER_RANK3 = EVAL_PARAM_PAWNCOVER_RANK2 + 4,
+	EVAL_PARAM_KINGFILEOPEN = EVAL_PARAM_PAWNCOVER_RANK3 + 4,
+	EVAL_PARAM_ADJACENTFILEOPEN,
+	EVAL_PARAM_KINGZONE_ATTACKERS,
+	/* pawn structure: per pawn protected by another, per pawn sharing its
+	 * file, isolated (on top of backward) and backward, and passed pawns
+	 * by rank, from white's side */
+	EVAL_PARAM_PS_CHAIN_BONUS = EVAL_PARAM_KINGZONE_ATTACKERS + 8,
+	EVAL_PARAM_PS_DOUBLED_PENALTY,
+	EVAL_PARAM_PS_ISOLATED_PENALTY,
+	EVAL_PARAM_PS_BACKWARD_PENALTY,
+	EVAL_PARAM_PS_PASSED_BONUS,
+	EVAL_NUM_PARAMS = EVAL_PARAM_PS_PASSED_BONUS + 8
+};
+extern int16_t eval_params[EVAL_NUM_PARAMS];
+extern char *eval_paramnames[EVAL_NUM_PARAMS];
+#define EVAL_PARAM(p) (eval_params[EVAL_PARAM_##p])
+
+/* the piece values live in the parameters too; these are the usual names */
+#define eval_piecevalue (&eval_params[EVAL_PARAM_PIECEVALUE])
+#define eval_piecevalue_endgame (&eval_params[EVAL_PARAM_PIECEVALUE_ENDGAME])
 
 /**
  * Is this board an endgame position
@@ -40,8 +102,52 @@ int eval_isendgame(board_t *);
 int16_t eval(board_t *);
 
 /**
- * Lazy eval - just the material difference
+ * Evaluate for a search window. If the score is inside (alpha, beta) it's the
+ * same as eval(). If it isn't, the eval may stop early and return the score
+ * from the stages it did: a rougher number, outside the window by more than
+ * the stage margins. The margins are guesses at how much the later stages
+ * can add, so the real score is usually outside the window too, but not
+ * always.
+ */
+int16_t eval_window(board_t *, int16_t alpha, int16_t beta);
+
+/**
+ * Evaluate with the neural network in the given file from now on, or with
+ * the classical eval if it's NULL. Returns 0 on success; if the file can't be
+ * loaded the old evaluator stays. Not while anything is searching.
+ */
+int eval_usenetwork(char *filename);
+
+/**
+ * Lazy eval - just the material and piece/square sums
  */
 int16_t eval_lazy(board_t *);
 
+/**
+ * Set an eval parameter by name. Returns 0, or -1 if there's no such name.
+ * The caches are cleared; boards keep the piece values they were set up with
+ * until they're set up again or board_recount() is run on them. Not while
+ * anything is searching.
+ */
+int eval_setparam(char *, int);
+
+/**
+ * Read parameters from a file of "name value" lines, like eval_saveparams
+ * writes. Returns -1 if the file can't be read or has a name we don't know.
+ */
+int eval_loadparams(char *filename);
+
+/**
+ * Write out all the parameters, one "name value" per line
+ */
+void eval_saveparams(FILE *);
+
+/**
+ * The full evaluation, from white's point of view, skipping all the caches,
+ * with how much each parameter counts for in it: trace[i] is how much the
+ * score goes up when parameter i does by one. The eval isn't quite linear, so
+ * that's only near the current values.
+ */
+int16_t eval_trace(board_t *, float trace[EVAL_NUM_PARAMS]);
+
 #endif
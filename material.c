@@ -0,0 +1,251 @@
+/****************************************************************************
+ * material.c - what the material on the board says, before the squares do
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include "material.h"
+#include "eval.h"
+#include "attacks.h"
+#include "bitscan.h"
+#include "popcnt.h"
+#include "bitbase.h"
+
+/* One entry per material signature, keyed on the board's material hash, with
+ * the data xored into the stored key like the pawn structure table. */
+typedef struct material_entry_t {
+	zobrist_t key;
+	material_t mat;
+} material_entry_t;
+
+/* there are only a few hundred signatures in any one game. must be a power
+ * of two */
+#ifndef MATERIAL_NUM_BUCKETS
+#define MATERIAL_NUM_BUCKETS 8192
+#endif
+static material_entry_t array[MATERIAL_NUM_BUCKETS];
+
+static zobrist_t material_check(material_t *mat)
+{
+	return ((uint16_t)mat->imbalance | ((uint32_t)mat->scale[WHITE] << 16) |
+	        ((uint32_t)mat->scale[BLACK] << 24)) ^
+	       (zobrist_t)(uintptr_t)mat->evaluator;
+}
+
+/* without pawns, being up less than this much is a draw */
+#define MATERIAL_DRAW_MARGIN 400
+
+/* on top of the usual score, for an ending we know is won */
+#define MATERIAL_KNOWN_WIN 500
+
+/* KBN vs K: how much to push the lone king towards a corner the bishop
+ * controls, and the kings towards each other */
+#define KBNK_CORNER_BONUS 20
+#define KBNK_KINGS_BONUS   4
+
+/* What the generic endgame evaluator would say, from white's point of view */
+static int16_t endgame_default(board_t *board)
+{
+	return board->squarevalue_endgame[WHITE] -
+	       board->squarevalue_endgame[BLACK];
+}
+
+/* how many king moves between two squares */
+static int kingdistance(square_t a, square_t b)
+{
+	int rowdist = ROW(a) - ROW(b);
+	int coldist = COL(a) - COL(b);
+	if (rowdist < 0) { rowdist = -rowdist; }
+	if (coldist < 0) { coldist = -coldist; }
+	return (rowdist > coldist) ? rowdist : coldist;
+}
+
+/**
+ * KP vs K - the bitbase knows. A win gets a bonus on top of the piece/square
+ * sums, which still tell the searcher to push the pawn.
+ */
+static int16_t endgame_kpk(board_t *board)
+{
+	if (bitbase_kpk(board) == BITBASE_DRAW)
+	{
+		return 0;
+	}
+	return endgame_default(board) +
+	       (board->pos[WHITE][PAWN] ? MATERIAL_KNOWN_WIN :
+	                                  -MATERIAL_KNOWN_WIN);
+}
+
+/**
+ * KB + rook pawns vs K - if the bishop doesn't control the promotion square
+ * and the lone king gets there, it can never be driven out
+ */
+static int16_t endgame_kbpk(board_t *board)
+{
+	unsigned char color = board->pos[WHITE][BISHOP] ? WHITE : BLACK;
+	bitboard_t pawns = board->pos[color][PAWN];
+	square_t bishopsquare = BITSCAN(board->pos[color][BISHOP]);
+	square_t king = BITSCAN(board->pos[OTHERCOLOR(color)][KING]);
+	square_t promotionsquare;
+
+	/* all the pawns have to be on the same rook file */
+	if ((pawns & ~BB_FILEA) && (pawns & ~BB_FILEH))
+	{
+		return endgame_default(board);
+	}
+	promotionsquare = SQUARE(COL(BITSCAN(pawns)),
+	                         (color == WHITE) ? RANK_8 : RANK_1);
+	/* check the square parities and also where's the enemy king */
+	if ((PARITY(bishopsquare) != PARITY(promotionsquare)) &&
+	    ((kingattacks[king] | BB_SQUARE(king)) &
+	     BB_SQUARE(promotionsquare)))
+	{
+		return 0;
+	}
+	return endgame_default(board);
+}
+
+/**
+ * KBN vs K - a win, but only in a corner the bishop can cover. The piece
+ * square tables only know about edges, so they can't find the mate.
+ */
+static int16_t endgame_kbnk(board_t *board)
+{
+	unsigned char color = board->pos[WHITE][BISHOP] ? WHITE : BLACK;
+	square_t bishopsquare = BITSCAN(board->pos[color][BISHOP]);
+	square_t king = BITSCAN(board->pos[color][KING]);
+	square_t loneking = BITSCAN(board->pos[OTHERCOLOR(color)][KING]);
+	int cornerdist, d;
+	int16_t value;
+
+	/* A1 and H8 are the same color, and A8 and H1 the other */
+	if (PARITY(bishopsquare) == PARITY(A1))
+	{
+		cornerdist = kingdistance(loneking, A1);
+		d = kingdistance(loneking, H8);
+	}
+	else
+	{
+		cornerdist = kingdistance(loneking, A8);
+		d = kingdistance(loneking, H1);
+	}
+	if (d < cornerdist) { cornerdist = d; }
+
+	value = board->squarevalue_endgame[color] -
+	        board->squarevalue_endgame[OTHERCOLOR(color)] +
+	        KBNK_CORNER_BONUS * (7 - cornerdist) +
+	        KBNK_KINGS_BONUS * (7 - kingdistance(king, loneking));
+	return (color == WHITE) ? value : -value;
+}
+
+/**
+ * Work out the material entry for the board from scratch
+ */
+static void material_compute(board_t *board, material_t *mat)
+{
+	int count[2][6];
+	int pawns, pieces[2], difference;
+	unsigned char color;
+	piece_t piece;
+
+	for (color = 0; color < 2; color++)
+	{
+		pieces[color] = 0;
+		for (piece = 0; piece < 6; piece++)
+		{
+			count[color][piece] = POPCOUNT(board->pos[color][piece]);
+			if ((piece != PAWN) && (piece != KING))
+			{
+				pieces[color] += count[color][piece];
+			}
+		}
+	}
+	pawns = count[WHITE][PAWN] + count[BLACK][PAWN];
+	difference = board->material[WHITE] - board->material[BLACK];
+	if (difference < 0) { difference = -difference; }
+
+	/* bishop/knight pair bonus/penalties */
+	mat->imbalance = 0;
+	if (count[WHITE][BISHOP] > 1) { mat->imbalance += EVAL_PARAM(BISHOP_PAIR); }
+	if (count[WHITE][KNIGHT] > 1) { mat->imbalance += EVAL_PARAM(KNIGHT_PAIR); }
+	if (count[BLACK][BISHOP] > 1) { mat->imbalance -= EVAL_PARAM(BISHOP_PAIR); }
+	if (count[BLACK][KNIGHT] > 1) { mat->imbalance -= EVAL_PARAM(KNIGHT_PAIR); }
+
+	mat->scale[WHITE] = MATERIAL_SCALE_NORMAL;
+	mat->scale[BLACK] = MATERIAL_SCALE_NORMAL;
+	mat->evaluator = NULL;
+
+	/* recognized endings - all of them have a lone king on one side */
+	for (color = 0; color < 2; color++)
+	{
+		unsigned char other = OTHERCOLOR(color);
+		if (pieces[other] || count[other][PAWN])
+		{
+			continue;
+		}
+		/* KNN vs K */
+		if ((count[color][KNIGHT] == 2) && (pieces[color] == 2) && !pawns)
+		{
+			mat->scale[color] = 0;
+		}
+		/* KBN vs K */
+		else if ((count[color][KNIGHT] == 1) &&
+		         (count[color][BISHOP] == 1) &&
+		         (pieces[color] == 2) && !pawns)
+		{
+			mat->evaluator = endgame_kbnk;
+		}
+		/* KB + rook pawn(s) vs K */
+		else if ((count[color][BISHOP] == 1) && (pieces[color] == 1) &&
+		         pawns)
+		{
+			mat->evaluator = endgame_kbpk;
+		}
+		/* KP vs K */
+		else if (!pieces[color] && (pawns == 1))
+		{
+			mat->evaluator = endgame_kpk;
+		}
+	}
+	/* a good heuristic to use is if no pawns are left and the material
+	 * difference is less than 400, the position is drawn */
+	if (!pawns && (difference < MATERIAL_DRAW_MARGIN))
+	{
+		mat->scale[WHITE] = 0;
+		mat->scale[BLACK] = 0;
+	}
+}
+
+void material_get(board_t *board, material_t *mat)
+{
+	zobrist_t key = board->materialhash;
+	material_entry_t *entry = &array[key & (MATERIAL_NUM_BUCKETS - 1)];
+	zobrist_t stored = entry->key;
+
+	*mat = entry->mat;
+	if ((stored ^ material_check(mat)) == key)
+	{
+		return;
+	}
+	material_compute(board, mat);
+	entry->mat = *mat;
+	entry->key = key ^ material_check(mat);
+}
+
+void material_clear()
+{
+	memset(array, 0, sizeof(array));
+}
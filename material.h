@@ -0,0 +1,58 @@
+/****************************************************************************
+ * material.h - what the material on the board says, before the squares do
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <stdint.h>
+#include "board.h"
+
+/* an endgame score gets multiplied by scale/MATERIAL_SCALE_NORMAL */
+#define MATERIAL_SCALE_NORMAL 16
+
+/**
+ * Evaluator for a recognized ending. Returns the score from white's point of
+ * view, like the endgame piece/square sums it stands in for.
+ */
+typedef int16_t (*material_evaluator_t)(board_t *);
+
+/**
+ * Everything that depends only on how many of each piece each side has:
+ * white's bonus for the balance of material (bishop pair and such), how far
+ * to scale down an endgame score when {WHITE,BLACK} is the side ahead (0 for
+ * a dead draw), and the evaluator to use instead of the generic endgame one,
+ * if we know this ending (NULL otherwise).
+ */
+typedef struct material_t {
+	int16_t imbalance;
+	uint8_t scale[2];
+	material_evaluator_t evaluator;
+} material_t;
+
+/**
+ * Look up the position's material signature. Hashed on the board's material
+ * hash, so usually this is one table lookup.
+ */
+void material_get(board_t *, material_t *);
+
+/**
+ * Empty the table, for when the parameters change
+ */
+void material_clear();
+
+#endif
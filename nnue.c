@@ -0,0 +1,411 @@
+/****************************************************************************
+ * nnue.c - efficiently updatable neural network evaluation
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <immintrin.h>
+#include "nnue.h"
+#include "bitscan.h"
+
+/****************************************************************************
+ * The network is the HalfKP 256x2-32-32-1 kind, in the usual .nnue file
+ * layout. Inputs are (own king square, piece, piece square) for every piece
+ * but the kings, from each side's point of view - black's board is rotated -
+ * and the first layer's output for each side is the accumulator the board
+ * keeps. Only a king move means starting that side's accumulator over; every
+ * other move adds and subtracts a few weight columns.
+ ****************************************************************************/
+/* 10 kinds of piece on 64 squares, plus one unused (kings had it) */
+#define NNUE_PIECE_SQUARES 641
+#define NNUE_INPUTS (64 * NNUE_PIECE_SQUARES)
+#define NNUE_L1 32
+#define NNUE_L2 32
+#define NNUE_VERSION 0x7af32f16
+/* hidden layer sums are scaled down by 2^6 before clipping */
+#define NNUE_WEIGHT_SHIFT 6
+#define NNUE_OUTPUT_SCALE 16
+/* the network's units - this is what it thinks a pawn is worth */
+#define NNUE_PAWN_VALUE 208
+
+typedef struct nnue_t {
+	/* the feature weights stay in the mapped file; they're most of it */
+	void *map;
+	size_t size;
+	const int16_t *ft_weights;
+	int16_t *ft_copy; /* if the file had them misaligned */
+	int16_t ft_biases[NNUE_HALFDIMS];
+	int32_t l1_biases[NNUE_L1];
+	int8_t l1_weights[NNUE_L1][2 * NNUE_HALFDIMS];
+	int32_t l2_biases[NNUE_L2];
+	int8_t l2_weights[NNUE_L2][NNUE_L1];
+	int32_t out_bias;
+	int8_t out_weights[NNUE_L2];
+} nnue_t;
+
+nnue_t *nnue_net = NULL;
+/* accumulators made for an earlier network don't count. never 0, which
+ * means "start over" */
+static unsigned int nnue_generation = 0;
+
+/****************************************************************************
+ * Kernels - plain C, and AVX2 where the processor has it
+ ****************************************************************************/
+static void nnue_addcolumn_scalar(int16_t *acc, const int16_t *column)
+{
+	int i;
+	for (i = 0; i < NNUE_HALFDIMS; i++)
+	{
+		acc[i] += column[i];
+	}
+}
+
+static void nnue_subcolumn_scalar(int16_t *acc, const int16_t *column)
+{
+	int i;
+	for (i = 0; i < NNUE_HALFDIMS; i++)
+	{
+		acc[i] -= column[i];
+	}
+}
+
+/* n must be a multiple of 32 */
+static int32_t nnue_dot_scalar(const uint8_t *input, const int8_t *weights,
+                               int n)
+{
+	int32_t sum = 0;
+	int i;
+	for (i = 0; i < n; i++)
+	{
+		sum += (int32_t)input[i] * weights[i];
+	}
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static void nnue_addcolumn_avx2(int16_t *acc, const int16_t *column)
+{
+	int i;
+	for (i = 0; i < NNUE_HALFDIMS; i += 16)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i *)(acc + i));
+		__m256i c = _mm256_loadu_si256((__m256i *)(column + i));
+		_mm256_storeu_si256((__m256i *)(acc + i), _mm256_add_epi16(a, c));
+	}
+}
+
+__attribute__((target("avx2")))
+static void nnue_subcolumn_avx2(int16_t *acc, const int16_t *column)
+{
+	int i;
+	for (i = 0; i < NNUE_HALFDIMS; i += 16)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i *)(acc + i));
+		__m256i c = _mm256_loadu_si256((__m256i *)(column + i));
+		_mm256_storeu_si256((__m256i *)(acc + i), _mm256_sub_epi16(a, c));
+	}
+}
+
+/* inputs are at most 127, so the pairwise 16-bit sums can't saturate */
+__attribute__((target("avx2")))
+static int32_t nnue_dot_avx2(const uint8_t *input, const int8_t *weights,
+                             int n)
+{
+	__m256i sum = _mm256_setzero_si256();
+	__m256i ones = _mm256_set1_epi16(1);
+	__m128i half;
+	int i;
+	for (i = 0; i < n; i += 32)
+	{
+		__m256i in = _mm256_loadu_si256((__m256i *)(input + i));
+		__m256i w = _mm256_loadu_si256((__m256i *)(weights + i));
+		__m256i products = _mm256_maddubs_epi16(in, w);
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+	}
+	half = _mm_add_epi32(_mm256_castsi256_si128(sum),
+	                     _mm256_extracti128_si256(sum, 1));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+	return _mm_cvtsi128_si32(half);
+}
+
+static void (*nnue_addcolumn)(int16_t *, const int16_t *) =
+	nnue_addcolumn_scalar;
+static void (*nnue_subcolumn)(int16_t *, const int16_t *) =
+	nnue_subcolumn_scalar;
+static int32_t (*nnue_dot)(const uint8_t *, const int8_t *, int) =
+	nnue_dot_scalar;
+
+/****************************************************************************
+ * Loading
+ ****************************************************************************/
+static uint32_t nnue_read32(const unsigned char *p)
+{
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static void nnue_free(nnue_t *net)
+{
+	munmap(net->map, net->size);
+	free(net->ft_copy);
+	free(net);
+}
+
+int nnue_load(char *filename)
+{
+	nnue_t *net;
+	struct stat st;
+	const unsigned char *p;
+	size_t ft_size = (size_t)NNUE_INPUTS * NNUE_HALFDIMS * sizeof(int16_t);
+	size_t expected;
+	uint32_t desc_length;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if (fstat(fd, &st) || st.st_size < 12)
+	{
+		close(fd);
+		return -1;
+	}
+	net = malloc(sizeof(nnue_t));
+	net->size = st.st_size;
+	net->ft_copy = NULL;
+	net->map = mmap(NULL, net->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (net->map == MAP_FAILED)
+	{
+		free(net);
+		return -1;
+	}
+	p = net->map;
+	/* header: version, hash, description */
+	desc_length = nnue_read32(p + 8);
+	expected = 12 + (size_t)desc_length +
+	           4 + sizeof(net->ft_biases) + ft_size +
+	           4 + sizeof(net->l1_biases) + sizeof(net->l1_weights) +
+	           sizeof(net->l2_biases) + sizeof(net->l2_weights) +
+	           sizeof(net->out_bias) + sizeof(net->out_weights);
+	if ((nnue_read32(p) != NNUE_VERSION) || (net->size != expected))
+	{
+		nnue_free(net);
+		return -1;
+	}
+	p += 12 + desc_length;
+	/* feature transformer: hash, biases, weights */
+	p += 4;
+	memcpy(net->ft_biases, p, sizeof(net->ft_biases));
+	p += sizeof(net->ft_biases);
+	if ((uintptr_t)p & (sizeof(int16_t) - 1))
+	{
+		net->ft_copy = malloc(ft_size);
+		memcpy(net->ft_copy, p, ft_size);
+		net->ft_weights = net->ft_copy;
+	}
+	else
+	{
+		net->ft_weights = (const int16_t *)p;
+	}
+	p += ft_size;
+	/* the rest of the network: hash, then each layer's biases and
+	 * weights */
+	p += 4;
+	memcpy(net->l1_biases, p, sizeof(net->l1_biases));
+	p += sizeof(net->l1_biases);
+	memcpy(net->l1_weights, p, sizeof(net->l1_weights));
+	p += sizeof(net->l1_weights);
+	memcpy(net->l2_biases, p, sizeof(net->l2_biases));
+	p += sizeof(net->l2_biases);
+	memcpy(net->l2_weights, p, sizeof(net->l2_weights));
+	p += sizeof(net->l2_weights);
+	memcpy(&net->out_bias, p, sizeof(net->out_bias));
+	p += sizeof(net->out_bias);
+	memcpy(net->out_weights, p, sizeof(net->out_weights));
+	/* we'll be reading the feature weights all over the place */
+	madvise(net->map, net->size, MADV_WILLNEED);
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		nnue_addcolumn = nnue_addcolumn_avx2;
+		nnue_subcolumn = nnue_subcolumn_avx2;
+		nnue_dot = nnue_dot_avx2;
+	}
+	nnue_unload();
+	nnue_generation++;
+	if (nnue_generation == 0)
+	{
+		nnue_generation++;
+	}
+	nnue_net = net;
+	return 0;
+}
+
+void nnue_unload()
+{
+	if (nnue_net != NULL)
+	{
+		nnue_free(nnue_net);
+		nnue_net = NULL;
+	}
+}
+
+int nnue_loaded()
+{
+	return nnue_net != NULL;
+}
+
+/****************************************************************************
+ * Accumulators
+ ****************************************************************************/
+static const int16_t *nnue_column(unsigned char perspective, square_t king,
+                                  square_t square, unsigned char color,
+                                  piece_t piece)
+{
+	unsigned int feature;
+	/* black sees the board turned around */
+	if (perspective == BLACK)
+	{
+		king ^= 0x3f;
+		square ^= 0x3f;
+	}
+	feature = (king * NNUE_PIECE_SQUARES) + 1 +
+	          (((piece * 2) + (color != perspective)) * 64) + square;
+	return nnue_net->ft_weights + ((size_t)feature * NNUE_HALFDIMS);
+}
+
+/* build one side's accumulator from scratch */
+static void nnue_refresh(board_t *board, unsigned char perspective)
+{
+	int16_t *acc = board->accumulator.v[perspective];
+	square_t king = BITSCAN(board->pos[perspective][KING]);
+	unsigned char color;
+	piece_t piece;
+	bitboard_t pos;
+	square_t square;
+
+	memcpy(acc, nnue_net->ft_biases, sizeof(nnue_net->ft_biases));
+	for (color = 0; color < 2; color++)
+	{
+		for (piece = PAWN; piece < KING; piece++)
+		{
+			pos = board->pos[color][piece];
+			while (pos)
+			{
+				square = BITSCAN(pos);
+				pos ^= BB_SQUARE(square);
+				nnue_addcolumn(acc, nnue_column(perspective, king,
+				                                square, color,
+				                                piece));
+			}
+		}
+	}
+	board->accumulator.generation[perspective] = nnue_generation;
+}
+
+void nnue_togglepiece(board_t *board, square_t square, unsigned char color,
+                      piece_t piece)
+{
+	nnue_accumulator_t *acc = &board->accumulator;
+	unsigned char perspective;
+	const int16_t *column;
+
+	/* every input of this side's depends on where its king is */
+	if (piece == KING)
+	{
+		acc->generation[color] = 0;
+		return;
+	}
+	for (perspective = 0; perspective < 2; perspective++)
+	{
+		if (acc->generation[perspective] != nnue_generation)
+		{
+			continue;
+		}
+		column = nnue_column(perspective,
+		                     BITSCAN(board->pos[perspective][KING]),
+		                     square, color, piece);
+		if (board->pos[color][piece] & BB_SQUARE(square))
+		{
+			nnue_addcolumn(acc->v[perspective], column);
+		}
+		else
+		{
+			nnue_subcolumn(acc->v[perspective], column);
+		}
+	}
+}
+
+/****************************************************************************
+ * Evaluation
+ ****************************************************************************/
+static uint8_t nnue_clip(int32_t x)
+{
+	return (x < 0) ? 0 : (x > 127) ? 127 : (uint8_t)x;
+}
+
+int16_t nnue_evaluate(board_t *board)
+{
+	uint8_t input[2 * NNUE_HALFDIMS] __attribute__((aligned(32)));
+	uint8_t hidden1[NNUE_L1] __attribute__((aligned(32)));
+	uint8_t hidden2[NNUE_L2] __attribute__((aligned(32)));
+	unsigned char us = board->tomove, them = OTHERCOLOR(board->tomove);
+	int32_t output;
+	int i;
+
+	if (board->accumulator.generation[WHITE] != nnue_generation)
+	{
+		nnue_refresh(board, WHITE);
+	}
+	if (board->accumulator.generation[BLACK] != nnue_generation)
+	{
+		nnue_refresh(board, BLACK);
+	}
+	/* the side to move's half goes first */
+	for (i = 0; i < NNUE_HALFDIMS; i++)
+	{
+		input[i] = nnue_clip(board->accumulator.v[us][i]);
+		input[NNUE_HALFDIMS + i] = nnue_clip(board->accumulator.v[them][i]);
+	}
+	for (i = 0; i < NNUE_L1; i++)
+	{
+		hidden1[i] = nnue_clip((nnue_net->l1_biases[i] +
+		                        nnue_dot(input, nnue_net->l1_weights[i],
+		                                 2 * NNUE_HALFDIMS)) >>
+		                       NNUE_WEIGHT_SHIFT);
+	}
+	for (i = 0; i < NNUE_L2; i++)
+	{
+		hidden2[i] = nnue_clip((nnue_net->l2_biases[i] +
+		                        nnue_dot(hidden1, nnue_net->l2_weights[i],
+		                                 NNUE_L1)) >>
+		                       NNUE_WEIGHT_SHIFT);
+	}
+	output = nnue_net->out_bias + nnue_dot_scalar(hidden2,
+	                                              nnue_net->out_weights,
+	                                              NNUE_L2);
+	return (int16_t)((output / NNUE_OUTPUT_SCALE) * 100 / NNUE_PAWN_VALUE);
+}
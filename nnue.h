@@ -0,0 +1,57 @@
+/****************************************************************************
+ * nnue.h - efficiently updatable neural network evaluation
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#ifndef NNUE_H
+#define NNUE_H
+
+#include <stdint.h>
+#include "board.h"
+
+/* the loaded network, or NULL */
+extern struct nnue_t *nnue_net;
+
+/**
+ * Map a network file into memory and start using it (replacing any loaded
+ * one). Returns 0 on success; on failure, whatever was loaded before is still
+ * in use. Not while anything is searching.
+ */
+int nnue_load(char *filename);
+
+/**
+ * Drop the network, going back to the classical eval. Not while anything is
+ * searching.
+ */
+void nnue_unload();
+
+/**
+ * Is there a network loaded
+ */
+int nnue_loaded();
+
+/**
+ * Evaluate with the network, for who's to move, like eval()
+ */
+int16_t nnue_evaluate(board_t *);
+
+/**
+ * Keep the board's accumulator up to date as a piece comes or goes; for
+ * board_togglepiece
+ */
+void nnue_togglepiece(board_t *, square_t, unsigned char, piece_t);
+
+#endif
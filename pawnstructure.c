@@ -17,119 +17,86 @@
  * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  * ****************************************************************************/
 #include <stdlib.h>
+#include <string.h>
 #include "board.h"
+#include "eval.h"
 #include "attacks.h"
 #include "pawnstructure.h"
 #include "popcnt.h"
 #include "bitscan.h"
+#include "profile.h"
 
-/* We do pawn square scoring here rather than in eval.c to save time */
-extern int16_t eval_squarevalue[2][6][64];
-
+/* One entry per pawn structure (both colors' pawns), keyed on the board's
+ * pawn hash. With the data xored into the stored key, a torn entry (from
+ * another thread writing it at the same time) doesn't match. Exactly one
+ * cache line. */
 typedef struct ps_entry_t {
-	bitboard_t key;
-	bitboard_t holes;
-	int16_t value;
-} ps_entry_t;
+	zobrist_t key;
+	pawnstructure_t ps;
+} __attribute__((aligned(64))) ps_entry_t;
 
-/* this is a lot like the transposition table in case you haven't noticed... */
+/* this is a lot like the transposition table in case you haven't noticed...
+ * there are far fewer pawn structures than positions, though. must be a
+ * power of two */
 #ifndef PS_NUM_BUCKETS
-#define PS_NUM_BUCKETS 4194301
+#define PS_NUM_BUCKETS 262144
 #endif
 static ps_entry_t array[PS_NUM_BUCKETS];
 
-static void ps_add(bitboard_t key, bitboard_t holes, int16_t value)
+static zobrist_t ps_check(pawnstructure_t *ps)
+{
+	return ((uint16_t)ps->value[WHITE] | ((uint32_t)(uint16_t)ps->value[BLACK] << 16)) ^
+	       ps->holes[WHITE] ^ ps->holes[BLACK] ^
+	       ps->passed[WHITE] ^ ps->passed[BLACK] ^
+	       ps->attacks[WHITE] ^ ps->attacks[BLACK];
+}
+
+static void ps_add(zobrist_t key, pawnstructure_t *ps)
 {
-	unsigned long bucket;
-	
-	/* find the bucket */
-	bucket = key % PS_NUM_BUCKETS;
+	ps_entry_t *entry = &array[key & (PS_NUM_BUCKETS - 1)];
 	/* always evict */
-	array[bucket].key = key;
-	array[bucket].holes = holes;
-	array[bucket].value = value;
-	
-	return;
+	entry->ps = *ps;
+	entry->key = key ^ ps_check(ps);
 }
 
 /**
- * Fetch data from the table.
+ * Fetch data from the table. Returns 1 on a hit, 0 on a miss.
  */
-#define PAWNSTRUCTURE_LOOKUP_FAIL INT16_MIN
-static int16_t ps_get(bitboard_t key, bitboard_t *holes)
+static int ps_get(zobrist_t key, pawnstructure_t *ps)
 {
-	unsigned long bucket = key % PS_NUM_BUCKETS;
-	if (array[bucket].key == key)
-	{
-		*holes = array[bucket].holes;
-		return array[bucket].value;
-	}
-	return PAWNSTRUCTURE_LOOKUP_FAIL;
+	ps_entry_t *entry = &array[key & (PS_NUM_BUCKETS - 1)];
+	zobrist_t stored = entry->key;
+	*ps = entry->ps;
+	return (stored ^ ps_check(ps)) == key;
 }
 
-/* Bonus for pawn chains - for each pawn protected by another, add bonus */
-#ifndef PS_CHAIN_BONUS
-#define PS_CHAIN_BONUS      2
-#endif
-/* Penalty for doubling pawns - for each pawn with another pawn on its file,
- * subtract the penalty (note, tripled pawns net loss 6 times this!) */
-#ifndef PS_DOUBLED_PENALTY
-#define PS_DOUBLED_PENALTY  8
-#endif
-/* Isolated penalty - for each pawn with no brothers on adjacent files
- * note, if a pawn gets this penalty it will also get the backwards penalty */
-#ifndef PS_ISOLATED_PENALTY
-#define PS_ISOLATED_PENALTY 16
-#endif
-/* Backward pawns - nothing on same rank or behind on adjacent columns */
-#ifndef PS_BACKWARD_PENALTY
-#define PS_BACKWARD_PENALTY 8
-#endif
+/* The bonuses and penalties are eval parameters (see eval.h). Passed pawn
+ * bonuses are by rank from white's side; black's are looked up mirrored. */
+#define PS_PARAM(p) EVAL_PARAM(PS_##p)
+#define PS_PASSED_RANK(color, square) \
+	(((color) == WHITE) ? ROW(square) : (RANK_8 - ROW(square)))
 
-/* Bonuses for having a passed pawn of <color> on the given <rank> */
-int16_t pawnstructure_passed_bonus[2][8] = {
-	{ 0,  3,  6, 12, 24, 48, 96, 0 },
-	{ 0, 96, 48, 24, 12,  6,  3, 0 }
-};
+/* add to a parameter's coefficient when tracing, from white's point of view */
+#define PS_TRACE(color, param, n) \
+	do { if (trace) { trace[param] += ((color) == WHITE) ? (n) : -(n); } } while (0)
 
 /**
- * Pawnstructure evaluator - color being whose pawns these are, and holes a
- * pass-by-reference second return value - a chart of all "holes" in the pawn
- * structure; that is, all squares which can never be attacked by these pawns.
+ * One side's pawns: fills in the score, the holes (squares these pawns can
+ * never attack), the passed pawns, and the squares attacked right now. With
+ * trace, also adds up what each parameter counted for.
  */
-int16_t eval_pawnstructure(board_t *board, unsigned char color, bitboard_t *h)
+static void ps_evalside(board_t *board, unsigned char color,
+                        pawnstructure_t *ps, float *trace)
 {
-	/* the value we calculate and store in the hashtable */
-	int16_t value;
-	/* value dependent on factors outside of just the pawn pos, so we
-	 * cannot hash this and must calculate even if the cache hits */
-	int16_t unhashable_bonus = 0;
-	
+	int16_t value = 0;
 	square_t square;
-	bitboard_t pawns, pos, friends, everybodyelse, behindmask, holes;
+	bitboard_t pawns, pos, friends, everybodyelse, behindmask, holes, passed;
 
 	pawns = board->pos[color][PAWN];
-	
-	/* attempt to lookup - if we succeed, only need to calculate the
-	 * unhashable bonus. pass in the h ptr as well; if the lookup
-	 * fails it'll be untouched */
-	if ((value = ps_get(pawns, h)) != PAWNSTRUCTURE_LOOKUP_FAIL)
-	{
-		while (pawns)
-		{
-			square = BITSCAN(pawns);
-			pawns ^= BB_SQUARE(square);
-			if (board_pawnpassed(board, square, color))
-			{
-				unhashable_bonus += pawnstructure_passed_bonus[color][ROW(square)];
-			}
-		}
-		return value + unhashable_bonus;
-	}
-	
 	/* holes starts with everything set, and we take off bits that our
 	 * pawns could attack (using passedpawn masks for this) */
 	holes = ~BB_SQUARE(0x0);
+	passed = BB(0x0);
 	/* for each pawn, consider its value with relation to the structure */
 	pos = pawns;
 	while (pos)
@@ -137,24 +104,29 @@ int16_t eval_pawnstructure(board_t *board, unsigned char color, bitboard_t *h)
 		/* find and clear a bit */
 		square = BITSCAN(pos);
 		pos ^= BB_SQUARE(square);
-		/* piece/square table */
-		value += eval_squarevalue[color][PAWN][square];
 
-		/* check for passed pawn */
+		/* check for passed pawn - only the other side's pawns can
+		 * stop it, and they're part of the key too */
 		if (board_pawnpassed(board, square, color))
 		{
-			unhashable_bonus += pawnstructure_passed_bonus[color][ROW(square)];
+			value += eval_params[EVAL_PARAM_PS_PASSED_BONUS +
+			                     PS_PASSED_RANK(color, square)];
+			PS_TRACE(color, EVAL_PARAM_PS_PASSED_BONUS +
+			                PS_PASSED_RANK(color, square), 1);
+			passed |= BB_SQUARE(square);
 		}
 		
 		everybodyelse = pawns ^ BB_SQUARE(square);
 		
 		/* first evaluate chaining */
 		friends = everybodyelse & pawnattacks[color][square];
-		value += PS_CHAIN_BONUS * POPCOUNT(friends);
+		value += PS_PARAM(CHAIN_BONUS) * POPCOUNT(friends);
+		PS_TRACE(color, EVAL_PARAM_PS_CHAIN_BONUS, POPCOUNT(friends));
 
 		/* next, doubled pawns */
 		friends = everybodyelse & BB_FILE(COL(square));
-		value -= PS_DOUBLED_PENALTY * POPCOUNT(friends);
+		value -= PS_PARAM(DOUBLED_PENALTY) * POPCOUNT(friends);
+		PS_TRACE(color, EVAL_PARAM_PS_DOUBLED_PENALTY, -POPCOUNT(friends));
 		
 		/* backwards */
 		friends = everybodyelse & bb_adjacentcols[COL(square)];
@@ -171,18 +143,46 @@ int16_t eval_pawnstructure(board_t *board, unsigned char color, bitboard_t *h)
 		}
 		if (!(friends & behindmask))
 		{
-			value -= PS_BACKWARD_PENALTY;
+			value -= PS_PARAM(BACKWARD_PENALTY);
+			PS_TRACE(color, EVAL_PARAM_PS_BACKWARD_PENALTY, -1);
 			/* see if isolated entirely */
 			if (!friends) /* SO RONERY */
 			{
-				value -= PS_ISOLATED_PENALTY;
+				value -= PS_PARAM(ISOLATED_PENALTY);
+				PS_TRACE(color, EVAL_PARAM_PS_ISOLATED_PENALTY, -1);
 			}
 		}
 		/* calculate holes in pawnstructure - any squares that this
 		 * pawn may be able to attack, take out of the bitmap */
 		holes ^= (bb_passedpawnmask[color][square] & ~BB_FILE(COL(square)));
 	}
-	ps_add(pawns, holes, value);
-	*h = holes;
-	return value + unhashable_bonus;
+	ps->value[color] = value;
+	ps->holes[color] = holes;
+	ps->passed[color] = passed;
+	ps->attacks[color] = board_pawnattacks(pawns, color);
+}
+
+void eval_pawnstructure(board_t *board, pawnstructure_t *ps)
+{
+	PROFILE_TIMER(PAWNSTRUCTURE);
+
+	if (ps_get(board->pawnhash, ps))
+	{
+		return;
+	}
+	ps_evalside(board, WHITE, ps, NULL);
+	ps_evalside(board, BLACK, ps, NULL);
+	ps_add(board->pawnhash, ps);
+}
+
+void eval_pawnstructure_trace(board_t *board, pawnstructure_t *ps,
+                              float *trace)
+{
+	ps_evalside(board, WHITE, ps, trace);
+	ps_evalside(board, BLACK, ps, trace);
+}
+
+void pawnstructure_clear()
+{
+	memset(array, 0, sizeof(array));
 }
@@ -23,12 +23,34 @@
 #include "board.h"
 
 /**
- * Evaluate the pawn structure given the position bitboard for the pawns. We
- * don't want to consider anything besides the position of the pawns relative
- * to each other - this just assigns rewards and penalties for pawn-related
- * issues such as doubled pawns, isolated pawns, etcetera.
- * Pass in the pawn position bitboard and the color to whom these pwans belong
+ * Everything about a position that depends on the pawns alone, for both
+ * colors: rewards and penalties for pawn-related issues such as doubled,
+ * isolated and passed pawns, the "holes" in each side's structure - squares
+ * its pawns can never attack - which pawns are passed, and which squares the
+ * pawns attack now.
  */
-int16_t eval_pawnstructure(board_t *, unsigned char, bitboard_t *);
+typedef struct pawnstructure_t {
+	int16_t value[2];
+	bitboard_t holes[2];
+	bitboard_t passed[2];
+	bitboard_t attacks[2];
+} pawnstructure_t;
+
+/**
+ * Evaluate the pawn structure of the position into the struct. Hashed on the
+ * board's pawn hash, so usually this is one table lookup.
+ */
+void eval_pawnstructure(board_t *, pawnstructure_t *);
+
+/**
+ * The same, skipping the table, adding to trace[] how much each eval
+ * parameter counted for (see eval_trace)
+ */
+void eval_pawnstructure_trace(board_t *, pawnstructure_t *, float *trace);
+
+/**
+ * Empty the table, for when the parameters change
+ */
+void pawnstructure_clear();
 
 #endif
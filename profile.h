@@ -0,0 +1,79 @@
+/****************************************************************************
+ * profile.h - cycle counters for the hot parts of the search
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+/**
+ * Built with -DPROFILE_CYCLES (make profile), each of these functions counts
+ * its calls and the cycles spent in it, per thread, and the searcher prints
+ * the totals after each search. A timer counts everything its function
+ * calls, so they nest: applymove includes regenerating the attacks, eval the
+ * pawn structure, and quiescence (entered from the main search) most of the
+ * rest. Reading the clock costs a few dozen cycles, which shows up most in
+ * the small ones like trans_get. Without the flag the timers aren't there.
+ */
+enum profile_timer {
+	PROFILE_GENERATEMOVES,
+	PROFILE_APPLYMOVE,
+	PROFILE_REGENERATE,
+	PROFILE_EVAL,
+	PROFILE_PAWNSTRUCTURE,
+	PROFILE_TRANS_GET,
+	PROFILE_QUIESCE,
+	PROFILE_NUM_TIMERS
+};
+
+#ifdef PROFILE_CYCLES
+
+extern __thread uint64_t profile_cycles[PROFILE_NUM_TIMERS];
+extern __thread unsigned long profile_calls[PROFILE_NUM_TIMERS];
+
+static inline uint64_t profile_rdtsc()
+{
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+typedef struct profile_timer_t {
+	uint64_t start;
+	int timer;
+} profile_timer_t;
+
+static inline void profile_stop(profile_timer_t *t)
+{
+	profile_cycles[t->timer] += profile_rdtsc() - t->start;
+	profile_calls[t->timer]++;
+}
+
+/* Goes after a function's declarations; the timer stops by itself however
+ * the function returns */
+#define PROFILE_TIMER(t) \
+	profile_timer_t profile_timer __attribute__((cleanup(profile_stop))) = \
+		{ profile_rdtsc(), PROFILE_##t }
+
+#else
+
+#define PROFILE_TIMER(t) do { } while (0)
+
+#endif
+
+#endif
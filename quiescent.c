@@ -20,43 +20,111 @@
 #include "quiescent.h"
 #include "eval.h"
 #include "movelist.h"
+#include "transposition.h"
+#include "search.h"
+#include "profile.h"
 
-extern volatile unsigned char timeup;
-extern int lazy, nonlazy;
+extern __thread volatile unsigned char timeup;
+extern __thread int qnodes;
+extern __thread int transposition_hits, transposition_misses;
 
 #ifndef QUIESCENT_MAX_DEPTH
-/* Warning: NEVER put this at 4 or below - it causes the bot to be too weak */
-#define QUIESCENT_MAX_DEPTH 8
+/* Warning: NEVER put this at 4 or below - it causes the bot to be too weak.
+ * Delta and SEE pruning keep the capture tree small, so this is mostly just a
+ * safety net now. */
+#define QUIESCENT_MAX_DEPTH 16
 #endif
 
-static int16_t qalphabeta(board_t *, int16_t, int16_t, uint8_t);
+/* Skip captures that can't possibly raise the score to alpha */
+#define QUIESCENT_DELTA_PRUNING
+#ifndef QUIESCENT_DELTA_MARGIN
+/* how much a capture could swing the positional part of the eval */
+#define QUIESCENT_DELTA_MARGIN 200
+#endif
+/* Skip captures that lose material according to the exchange evaluator */
+#define QUIESCENT_SEE_PRUNING
+
+static int16_t qalphabeta(board_t *, int16_t, int16_t, uint8_t, uint8_t);
+
+/**
+ * Store a quiescence result at searchdepth 0. If the slot already has a real
+ * search result for this position we leave it alone - any depth is at least
+ * as good as ours, and the main search wants its hashmove back.
+ */
+static void qtrans_add(board_t *board, move_t move, int16_t value, uint8_t ply,
+                       unsigned char flag)
+{
+	trans_data_t old = trans_get(board->hash);
+	if (trans_data_valid(old) && TRANS_SEARCHDEPTH(old) > 0)
+	{
+		return;
+	}
+	trans_add(board->hash, move, board->reps, VALUE_TO_TRANS(value, ply),
+	          (board->moves - ply), board->moves, 0, flag);
+}
+
+/**
+ * The most material a move could win outright: whatever it captures, and the
+ * promoted piece less the pawn it used to be.
+ */
+static int16_t qmaterialgain(move_t move)
+{
+	int16_t gain = 0;
+	if (MOV_CAPT(move))
+	{
+		gain += eval_piecevalue[MOV_CAPTPC(move)];
+	}
+	if (MOV_PROM(move))
+	{
+		gain += eval_piecevalue[MOV_PROMPC(move)] - eval_piecevalue[PAWN];
+	}
+	return gain;
+}
 
 /**
  * Play out capture chains in a position until it's quiet (or until a certain
- * depth is reached, for speed) so we can accurately use the evaluator
+ * depth is reached, for speed) so we can accurately use the evaluator. ply is
+ * how far this position is from the root of the main search.
  */
-int16_t quiesce(board_t *board, int16_t alpha, int16_t beta)
+int16_t quiesce(board_t *board, int16_t alpha, int16_t beta, uint8_t ply)
 {
-	return qalphabeta(board, alpha, beta, QUIESCENT_MAX_DEPTH);
+	PROFILE_TIMER(QUIESCE);
+	return qalphabeta(board, alpha, beta, QUIESCENT_MAX_DEPTH, ply);
 }
 
 /**
  * Alpha beta searching over captures. Don't need to return a move, only the
- * value. No repetition/50-move checking (obvious reasons), no transposition
- * table (simplicity) - we get pretty good move ordering for captures already
- * from the board library.
+ * value. No repetition/50-move checking (obvious reasons). We share the
+ * transposition table with the main search: entries of any depth can give us
+ * a cutoff, and we store our own results at searchdepth 0 so the same capture
+ * sequences in sibling subtrees don't get played out again. Apart from the
+ * hashed capture we rely on the board library's ordering.
+ *
+ * A side in check can't stand pat, so there we search every evasion instead
+ * (and return a mate score if there are none). At the first ply we also try
+ * quiet checking moves, which together with the evasions lets quiescence see
+ * short mating attacks without the main search extending for them.
  */
 static int16_t qalphabeta(board_t *board, int16_t alpha, int16_t beta,
-                         uint8_t depth)
+                         uint8_t depth, uint8_t ply)
 {
 	movelist_t moves;
 	move_t curmove;
 	/* who has the move */
 	int color;
-	//XXX: due to we're only generating captures, we can't check if we get
-	//XXX: mated here... this seems bad, but should turn out ok (i.e., a
-	//XXX: quiescence that doesn't see mates is better than no quiescence
-	//XXX: at all.
+	/* transposition table */
+	trans_data_t trans_data;
+	int16_t orig_alpha = alpha;
+	move_t hashmove, returnmove;
+	/* delta pruning is unsafe when there's little material left, since
+	 * the endgame eval's bonuses can outweigh the margin */
+	unsigned char delta;
+	/* in check means we're searching evasions, not captures */
+	unsigned char incheck;
+	/* for mate detection when in check */
+	unsigned char children_searched;
+	/* 0 for the capture list, 1 for the quiet checks list */
+	unsigned char stage;
 	
 	/* used in place of lastval */
 	int16_t a;
@@ -64,30 +132,70 @@ static int16_t qalphabeta(board_t *board, int16_t alpha, int16_t beta,
 	/* what happens if the player to move declines to make any captures */
 	int16_t stand_pat;
 
+	qnodes++;
+	search_polltime();
 	if (timeup)
 	{
 		return 0;
 	}
-	
-	/* we'll be using stand_pat in a lot of places*/
-	/* first do a lazy evaluation; if it's too far from the window we will
-	 * not need the precision of eval() */
-	stand_pat = eval_lazy(board);
-	/* check if we're not allowed to be lazy */
-	if ((stand_pat > (alpha - EVAL_LAZY_THRESHHOLD)) &&
-	    (stand_pat < (beta + EVAL_LAZY_THRESHHOLD)))
+	incheck = board_incheck(board);
+
+	/********************************************************************
+	 * check transposition table - any searchdepth is deep enough
+	 ********************************************************************/
+	hashmove = 0;
+	trans_data = trans_get(board->hash);
+	if (trans_data_valid(trans_data))
 	{
-		stand_pat = eval(board);
-		nonlazy++;
+		if (TRANS_REPS(trans_data) >= board->reps)
+		{
+			int16_t storedval = VALUE_FROM_TRANS(TRANS_VALUE(trans_data),
+			                                     ply);
+			if ((TRANS_FLAG(trans_data) == TRANS_FLAG_EXACT) ||
+			    ((TRANS_FLAG(trans_data) == TRANS_FLAG_BETA) &&
+			     (storedval >= beta)) ||
+			    ((TRANS_FLAG(trans_data) == TRANS_FLAG_ALPHA) &&
+			     (storedval <= alpha)))
+			{
+				transposition_hits++;
+				return storedval;
+			}
+		}
+		/* the main search may have left a quiet move here; unless
+		 * it's an evasion, we only want to try captures (and
+		 * promotions) first */
+		hashmove = TRANS_MOVE(trans_data);
+		if (!(incheck || MOV_CAPT(hashmove) || MOV_PROM(hashmove)))
+		{
+			hashmove = 0;
+		}
+	}
+	else
+	{
+		transposition_misses++;
+	}
+
+	if (incheck)
+	{
+		/* no standing pat; the evasions have to speak for us */
+		stand_pat = -SEARCHER_INFINITY;
+	}
+	else
+	{
+		/* we'll be using stand_pat in a lot of places. far outside the
+		 * window, the eval can stop early with a bound: that's still
+		 * enough to fail high on, or to delta prune against */
+		stand_pat = eval_window(board, alpha, beta);
 	}
-	else { lazy++; }
 
 	/********************************************************************
 	 * terminal condition - search depth ran out
 	 ********************************************************************/
 	if (depth == 0)
 	{
-		return stand_pat;
+		/* a position in check has no real static value, but this is
+		 * where we have to stop, so use what the eval says */
+		return incheck ? eval(board) : stand_pat;
 	}
 	
 	/********************************************************************
@@ -98,42 +206,134 @@ static int16_t qalphabeta(board_t *board, int16_t alpha, int16_t beta,
 	{
 		if (stand_pat >= beta)
 		{
+			qtrans_add(board, 0, stand_pat, ply, TRANS_FLAG_BETA);
 			return stand_pat;
 		}
 		alpha = stand_pat;
 	}
 	color = board->tomove;
+	returnmove = 0;
+	children_searched = 0;
+	delta = !incheck && !eval_isendgame(board);
 	
-	/* and we're ready to go */
-	board_generatecaptures(board, &moves);
-	while (!movelist_isempty(&moves))
+	/* the hashed move first; it was the best one last time */
+	if (hashmove)
 	{
-		if (timeup)
+		board_applymove(board, hashmove);
+		a = -qalphabeta(board, -beta, -alpha, depth-1, ply+1);
+		board_undomove(board, hashmove);
+		children_searched++;
+		if (a > alpha)
 		{
-			break;
+			alpha = a;
+			returnmove = hashmove;
 		}
-		curmove = movelist_remove_max(&moves);
-		
-		board_applymove(board, curmove);
-		/* see if this move puts us in check */
-		if (board_colorincheck(board, color))
+		if (beta <= alpha)
 		{
-			board_undomove(board, curmove);
-			continue;
+			goto qalphabeta_after_iteration;
 		}
-		a = -qalphabeta(board, -beta, -alpha, depth-1);
-		board_undomove(board, curmove);
+	}
 
-		if (a > alpha)
+	/* and we're ready to go */
+	if (incheck)
+	{
+		board_generatemoves(board, &moves);
+	}
+	else
+	{
+		board_generatecaptures(board, &moves);
+	}
+	for (stage = 0; stage < 2; stage++)
+	{
+		/* quiet checks, only at the first ply */
+		if (stage == 1)
 		{
-			alpha = a;
+			if (incheck || (depth != QUIESCENT_MAX_DEPTH) ||
+			    (beta <= alpha) || timeup)
+			{
+				break;
+			}
+			board_generatechecks(board, &moves);
 		}
-		if (beta <= alpha)
+		while (!movelist_isempty(&moves))
 		{
-			break;
+			if (timeup)
+			{
+				break;
+			}
+			curmove = movelist_remove_max(&moves);
+			/* already searched it */
+			if (curmove == hashmove)
+			{
+				continue;
+			}
+#ifdef QUIESCENT_DELTA_PRUNING
+			/* even winning the material for free leaves us below
+			 * alpha. a quiet check might still be mate, though */
+			if (delta && (stage == 0) &&
+			    ((stand_pat + qmaterialgain(curmove) +
+			      QUIESCENT_DELTA_MARGIN) <= alpha))
+			{
+				continue;
+			}
+#endif
+#ifdef QUIESCENT_SEE_PRUNING
+			/* the recapture costs more than we took. Promotions
+			 * are always tried, and taking something at least as
+			 * valuable as the capturer can't lose, so don't
+			 * bother calculating those */
+			if (!incheck && !MOV_PROM(curmove) &&
+			    (!MOV_CAPT(curmove) ||
+			     (eval_piecevalue[MOV_PIECE(curmove)] >
+			      eval_piecevalue[MOV_CAPTPC(curmove)])) &&
+			    (board_see(board, curmove) < 0))
+			{
+				continue;
+			}
+#endif
+			
+			board_applymove(board, curmove);
+			/* see if this move puts us in check */
+			if (board_colorincheck(board, color))
+			{
+				board_undomove(board, curmove);
+				continue;
+			}
+			a = -qalphabeta(board, -beta, -alpha, depth-1, ply+1);
+			board_undomove(board, curmove);
+			children_searched++;
+
+			if (a > alpha)
+			{
+				alpha = a;
+				returnmove = curmove;
+			}
+			if (beta <= alpha)
+			{
+				break;
+			}
 		}
+		movelist_destroy(&moves);
 	}
-	movelist_destroy(&moves);
-	
+
+qalphabeta_after_iteration:
+	/* don't shit all over the trans table with results from a search
+	 * that got cut off */
+	if (timeup)
+	{
+		return 0;
+	}
+	/* in check with no way out. that's mate for anyone, at any depth */
+	if (incheck && !children_searched)
+	{
+		alpha = -(SEARCHER_MATE - ply);
+		trans_add(board->hash, 0, board->reps, VALUE_TO_TRANS(alpha, ply),
+		          (board->moves - ply), board->moves,
+		          TRANS_SEARCHDEPTH_TERMINAL, TRANS_FLAG_EXACT);
+		return alpha;
+	}
+	qtrans_add(board, returnmove, alpha, ply,
+	           (beta <= alpha) ? TRANS_FLAG_BETA :
+	           (alpha > orig_alpha) ? TRANS_FLAG_EXACT : TRANS_FLAG_ALPHA);
 	return alpha; /* will work even if no captures were available */
 }
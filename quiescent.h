@@ -22,6 +22,6 @@
 #include <stdint.h>
 #include "board.h"
 
-int16_t quiesce(board_t *board, int16_t alpha, int16_t beta);
+int16_t quiesce(board_t *board, int16_t alpha, int16_t beta, uint8_t ply);
 
 #endif
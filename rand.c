@@ -35,6 +35,12 @@ void rand_init()
 	rand_initted = 1;
 }
 
+void rand_seed(unsigned long seed)
+{
+	rand_init();
+	gsl_rng_set(randgen, seed);
+}
+
 uint32_t rand32()
 {
 	rand_init();
@@ -20,7 +20,8 @@
  * Uses the Mersenne Twister algorithm provided by GSL, the GNU Scientific
  * Library. Compile with "-lgsl -lgslcblas". We seed the Twister using the
  * current UNIX timestamp, so the values will vary for each run of the
- * program. This allows for nondeterministic play if desired.
+ * program. This allows for nondeterministic play if desired. Reseed before
+ * the zobrist keys are made (the first board_init) for repeatable runs.
  */
 #ifndef _RAND_H
 #define _RAND_H
@@ -29,6 +30,8 @@
 
 /* Set up the random number generator */
 void rand_init();
+/* Start the sequence over from the given seed */
+void rand_seed(unsigned long);
 /* A "random" 32-bit integer as provided by GSL's mersenne twister */
 uint32_t rand32();
 /* A "random" 64-bit integer as provided by GSL's mersenne twister */
@@ -19,51 +19,86 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <unistd.h>
-#include <signal.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
 #include "search.h"
 #include "eval.h"
 #include "quiescent.h"
 #include "movelist.h"
 #include "transposition.h"
+#include "bitbase.h"
+#include "profile.h"
 #include "assert.h"
 
-/* Constants for the search algorithm */
-#define SEARCHER_INFINITY 32767
-#define SEARCHER_MATE 16383
-
 /* could be changed if you wanted to {dis,en}courage draws
  * TODO: make the evaluator also use this */
 #define SEARCHER_DRAW_SCORE 0
 #define VALUE_ISDRAW(v) ((v) == SEARCHER_DRAW_SCORE)
 
 static move_t alphabeta(board_t *, int16_t, int16_t, uint8_t, uint8_t, move_t, uint8_t, uint8_t, unsigned char);
+#ifdef PROFILE_CYCLES
+static void search_profilereport(uint64_t);
+#endif
 
-int transposition_hits, transposition_misses;
-extern int regen_hits, regen_misses;
+/* A search's state is all thread-local, so that several searches can run at
+ * once (see testsuite_epd). What's shared: the trans table, which other
+ * searches can only make better informed, the pruning parameters, interrupt
+ * requests, and the analysis status below. */
+__thread int transposition_hits, transposition_misses;
+extern __thread int regen_hits, regen_misses;
+extern __thread int evalcache_hits, evalcache_misses;
+extern __thread int eval_stage_exits[EVAL_NUM_STAGES];
 
-static int nodes;
-static int16_t lastval;
+static __thread int nodes;
+static __thread int16_t lastval;
 
 /* used for printing shit - too lazy to headerize these guys */
 #define TTYOUT_COLOR "\033[00;37m"
 #define DEFAULT_COLOR "\033[00m"
-#define BUF_SIZE
+#define BUF_SIZE 2048
 extern FILE *ttyout;
-extern char outbuf[BUF_SIZE];
+extern __thread char outbuf[BUF_SIZE];
 void output(char *);
+void output_xboard(char *);
 
 /* Used for iterative deepening and replacement policy in the trans table */
-static uint8_t cur_searching_depth;
+static __thread uint8_t cur_searching_depth;
 
 /* used for iterative deepening */
-volatile unsigned char timeup;
+__thread volatile unsigned char timeup;
 
-#define SEARCHER_MIN_DEPTH 4
-#define SEARCHER_MAX_DEPTH 63
+/* how many requests of each kind (indexed by SEARCH_MOVENOW, SEARCH_ABORT)
+ * another thread has made to cut the search short; see search_interrupt() */
+static volatile int interrupts[3];
 
-#define VALUE_ISMATE(v) (((v) >= SEARCHER_MATE - SEARCHER_MAX_DEPTH) || ((v) <= -(SEARCHER_MATE - SEARCHER_MAX_DEPTH)))
+/* timing - when the search started, and how long it may go on for */
+static __thread struct timespec search_start;
+static __thread search_limits_t *search_limits;
+/* when pondering, the limits only start counting once we get a ponder hit;
+ * this is how far into the search that happened */
+static __thread unsigned char search_pondering;
+static __thread unsigned int search_limitbase;
+static __thread unsigned long search_nodebase;
+/* how many nodes (main and quiescent) between looking at the clock */
+#ifndef SEARCHER_POLL_NODES
+#define SEARCHER_POLL_NODES 4096
+#endif
+static __thread unsigned int poll_countdown;
+/* or more often, with a node limit smaller than that */
+static __thread unsigned int poll_interval;
+/* guess at how much longer the next iteration takes than the last one; if
+ * it won't fit before the hard limit we don't start it */
+#ifndef SEARCHER_ITERATION_GROWTH
+#define SEARCHER_ITERATION_GROWTH 2
+#endif
+
+#define SEARCHER_MIN_DEPTH 4
+/* the depth the preliminary search actually goes to - less, if the limits
+ * say to stop before it */
+static __thread uint8_t first_depth;
 
 /* aspiration windows - first try a window of aspir_1 around prevalpha; if
  * that fails go to aspir_2; if that fails use the full -inf,+inf search */
@@ -93,17 +128,79 @@ volatile unsigned char timeup;
 #define SEARCHER_USE_KILLERS
 #ifdef SEARCHER_USE_KILLERS
 #define SEARCHER_NUM_KILLERS 3
-static move_t killers[SEARCHER_MAX_DEPTH][SEARCHER_NUM_KILLERS];
+static __thread move_t killers[SEARCHER_MAX_DEPTH][SEARCHER_NUM_KILLERS];
 #endif
 
-/* margins for futility pruning - how far away from the window do we need
- * to be in order to consider doing futility pruning. note that the value at
- * 0 will never be used */
-#ifdef SEARCHER_FUTILITY_PRUNING
-static int16_t futility_margin[3] = { 0xbeef, 250, 450 };
+/* the depth-limited pruning rules; see search.h. the names are what
+ * search_setparam() takes */
+int search_params[SEARCH_NUM_PARAMS] = {
+	3, 120, /* reverse futility */
+	2, 300, /* razoring */
+	2, 200, /* futility */
+	3, 4    /* late move pruning */
+};
+char *search_paramnames[SEARCH_NUM_PARAMS] = {
+	"rfp_depth", "rfp_margin",
+	"razor_depth", "razor_margin",
+	"futility_depth", "futility_margin",
+	"lmp_depth", "lmp_base"
+};
+#define PARAM(p) (search_params[SEARCH_PARAM_##p])
+/* how often each rule fired, for the statistics after the search */
+static __thread int rfp_prunes, razor_prunes, futility_prunes, lmp_prunes;
+
+#ifdef PROFILE_CYCLES
+/* see profile.h; the search owns the counters, and starts them over */
+__thread uint64_t profile_cycles[PROFILE_NUM_TIMERS];
+__thread unsigned long profile_calls[PROFILE_NUM_TIMERS];
+static char *profile_names[PROFILE_NUM_TIMERS] = {
+	"generatemoves", "applymove", "regenerate", "eval", "pawnstructure",
+	"trans_get", "quiesce"
+};
+static __thread uint64_t profile_searchstart;
 #endif
 
-int lazy, nonlazy;
+/* how many positions quiescence looked at */
+__thread int qnodes;
+/* nodes (main and quiescent) from the depths before the current one */
+static __thread int prevnodes;
+
+/* principal variation, in a triangular array: pv[ply] holds the best line
+ * found from that ply on, from pv[ply][ply] to pv[ply][pv_length[ply]-1].
+ * A node copies its child's line behind its own best move. */
+static __thread move_t pv[SEARCHER_MAX_DEPTH][SEARCHER_MAX_DEPTH];
+static __thread uint8_t pv_length[SEARCHER_MAX_DEPTH];
+/* the PV from the last completed iteration; the next iteration searches
+ * along it first. pv_follow tells a node its parent is still on it */
+static __thread move_t prevpv[SEARCHER_MAX_DEPTH];
+static __thread uint8_t prevpv_length;
+static __thread unsigned char pv_follow;
+/* score of the best root move so far this iteration, pv[0][0] */
+static __thread int16_t root_value;
+
+/* xboard's "post" - print thinking output after each iteration */
+unsigned char search_post;
+#define SEARCHER_POST_SIZE 1024
+/* for xboard's "." status command: the root move being searched, how many
+ * root moves this iteration has started on, and how many there are */
+static volatile move_t root_move;
+static volatile int root_searched;
+static volatile int root_total;
+/* set while the root runs an IID search of itself: the lines that finds are
+ * shallower than the depth we're on, so they aren't posted, and its moves
+ * aren't the ones the status counts */
+static __thread unsigned char root_iid;
+/* and the rest of the status, which the searching thread copies out of its
+ * own state every time it looks at the clock */
+static volatile unsigned int status_elapsed;
+static volatile unsigned long status_nodes;
+static volatile uint8_t status_depth;
+/* the opponent's reply that the last finished search expects */
+static volatile move_t search_reply;
+/* when the search first chose the move it ended up with; see
+ * search_settled() */
+static __thread unsigned int settled_ms;
+static __thread uint8_t settled_depth;
 
 /* determining the type of a child from a parent (first index - parent's type)
  * given whether the first child (0 or 1, second index) has been searched */
@@ -121,66 +218,515 @@ static unsigned char childnodetype[3][2] = {
 /* null-move depth reduction - dependent on depth */
 #define NULLMOVE_R(d) (((d) > 6) ? 3 : 2)
 
+/* Internal iterative deepening - how deep a PV or CUT node without a hash
+ * move must be before we search it shallower first to find one, and how
+ * much shallower */
+#define SEARCHER_IID_DEPTH 3
+#define SEARCHER_IID_REDUCTION 2
+static __thread int iid_searches;
+
 /* Late move reduction - we reduce after searching this many nodes given the
  * current node type (allows us to be more conservative at PV nodes) */
-static uint8_t lmr_movecount[3] = { 16, 8, 8 };
+static uint8_t lmr_movecount[3] = { 4, 2, 2 };
+/* how far to reduce, by node type, remaining depth and how many moves were
+ * searched before this one: lmr_base + ln(depth) * ln(moves) / lmr_divisor,
+ * so reductions grow slowly with both. filled in by the first search */
+#define SEARCHER_LMR_MOVES 64
+static uint8_t lmr_table[3][SEARCHER_MAX_DEPTH+1][SEARCHER_LMR_MOVES];
+static pthread_once_t lmr_initialized = PTHREAD_ONCE_INIT;
+static double lmr_base[3] = { 0.0, 0.5, 0.25 };
+static double lmr_divisor[3] = { 3.0, 2.0, 2.25 };
+
+/* History heuristic - how often a quiet move from/to these squares caused a
+ * cutoff lately, and how often it was searched in vain before one. Cutoffs
+ * push a score toward +SEARCHER_HISTORY_MAX and failures toward the
+ * negative, more slowly the closer it already is. LMR reduces moves with
+ * a good history less and a bad history more, a ply per LMR_SCALE */
+#define SEARCHER_HISTORY_MAX 16384
+#define SEARCHER_HISTORY_LMR_SCALE 8192
+static __thread int16_t history_table[2][64][64];
+/* quiet moves a node searched without a cutoff, to be penalized if a later
+ * one cuts */
+#define SEARCHER_MAX_QUIETS 64
+#define SEARCHER_QUIET(m) (!MOV_CAPT(m) && !MOV_PROM(m))
+
+/* static eval at each ply of the current line, to tell whether the side to
+ * move is doing better than on its last turn. none when in check */
+#define SEARCHER_NO_EVAL SEARCHER_INFINITY
+static __thread int16_t evalstack[SEARCHER_MAX_DEPTH+1];
 
-void sigalrm_handler()
+/**
+ * Nodes (main and quiescent) searched since getbestmove() was called
+ */
+static unsigned long search_nodecount()
 {
-	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: TIMEUP!");
-	output(outbuf);
-	timeup = 1;
+	return (unsigned long)prevnodes + nodes + qnodes;
+}
+
+/**
+ * Milliseconds since getbestmove() was called - or with an nps limit, how
+ * long the nodes searched would have taken at that speed
+ */
+static unsigned int search_elapsed()
+{
+	struct timespec now;
+	if (search_limits->nps)
+	{
+		return (search_nodecount() * 1000) / search_limits->nps;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((now.tv_sec - search_start.tv_sec) * 1000) +
+	       ((now.tv_nsec - search_start.tv_nsec) / 1000000);
+}
+
+/**
+ * Milliseconds the time limits have been running for. Notices a ponder hit
+ * and starts the limits from there.
+ */
+static unsigned int search_limitelapsed()
+{
+	unsigned int elapsed = search_elapsed();
+	if (search_pondering && !search_limits->ponder)
+	{
+		search_pondering = 0;
+		search_limitbase = elapsed;
+		search_nodebase = search_nodecount();
+		snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Ponder hit at %u ms; will search for %u ms (at most %u ms) more",
+		         elapsed, search_limits->soft_ms, search_limits->hard_ms);
+		output(outbuf);
+	}
+	return elapsed - search_limitbase;
+}
+
+/**
+ * Whether there's a move to play if we stop now: a depth has been finished,
+ * or the preliminary search has a score for at least one root move
+ */
+static int search_haveresult()
+{
+	return (cur_searching_depth > first_depth) || (pv_length[0] > 0);
+}
+
+void search_polltime()
+{
+	if (--poll_countdown)
+	{
+		return;
+	}
+	poll_countdown = poll_interval;
+	if (timeup)
+	{
+		return;
+	}
+	status_elapsed = search_elapsed();
+	status_nodes = search_nodecount();
+	status_depth = cur_searching_depth;
+	/* whoever stopped us doesn't want the result anyway */
+	if (search_limits->stop || interrupts[SEARCH_ABORT])
+	{
+		timeup = 1;
+		return;
+	}
+	/* the clock never stops the preliminary search, so there's a move to
+	 * fall back on. told to move now (or out of nodes), any root move with
+	 * a score will do */
+	if (interrupts[SEARCH_MOVENOW] && !search_pondering &&
+	    search_haveresult())
+	{
+		snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Told to move now");
+		output(outbuf);
+		timeup = 1;
+	}
+	else if ((search_limitelapsed() >= search_limits->hard_ms) &&
+	         !search_pondering && (cur_searching_depth > first_depth))
+	{
+		snprintf(outbuf, BUF_SIZE-1, "SEARCHER: TIMEUP!");
+		output(outbuf);
+		timeup = 1;
+	}
+	else if (search_limits->nodes && !search_pondering &&
+	         (search_nodecount() - search_nodebase >= search_limits->nodes) &&
+	         search_haveresult())
+	{
+		snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Node limit reached");
+		output(outbuf);
+		timeup = 1;
+	}
+}
+
+/**
+ * A move at this ply raised alpha, so it and the line its child found are our
+ * new best line. Don't bother with extensions past the end of the array.
+ */
+static void search_updatepv(uint8_t ply, move_t move)
+{
+	uint8_t i;
+	if (ply >= SEARCHER_MAX_DEPTH - 1)
+	{
+		return;
+	}
+	pv[ply][ply] = move;
+	for (i = ply + 1; i < pv_length[ply+1]; i++)
+	{
+		pv[ply][i] = pv[ply+1][i];
+	}
+	pv_length[ply] = (pv_length[ply+1] > ply + 1) ? pv_length[ply+1] : ply + 1;
+}
+
+/**
+ * xboard thinking output: depth, score, time in centiseconds, nodes, and the
+ * principal variation. result stands in for a line that's empty.
+ */
+static void search_postpv(uint8_t depth, int16_t value, move_t *line,
+                          uint8_t length, move_t result)
+{
+	char post[SEARCHER_POST_SIZE];
+	char *movestr;
+	int len;
+	uint8_t i;
+
+	len = snprintf(post, SEARCHER_POST_SIZE-1, "%d %d %u %lu", depth,
+	               value, search_elapsed() / 10, search_nodecount());
+	/* a hit on the root in the trans table leaves no line */
+	if (length == 0)
+	{
+		movestr = move_tostring(result);
+		snprintf(post + len, SEARCHER_POST_SIZE-1-len, " %s", movestr);
+		free(movestr);
+	}
+	for (i = 0; i < length && len < SEARCHER_POST_SIZE - 8; i++)
+	{
+		movestr = move_tostring(line[i]);
+		len += snprintf(post + len, SEARCHER_POST_SIZE-1-len, " %s", movestr);
+		free(movestr);
+	}
+	output_xboard(post);
+}
+
+/**
+ * Some move besides the last iteration's best just raised alpha at the root.
+ * Post the new line right away rather than at the end of the depth, which in
+ * analysis can be a long time coming. A fail high on an aspiration window is
+ * only a bound, so that waits for the re-search.
+ */
+static void search_rootchange(int16_t alpha, int16_t beta)
+{
+	root_value = alpha;
+	if (search_post && !timeup && !root_iid && (alpha < beta))
+	{
+		search_postpv(cur_searching_depth, alpha, pv[0], pv_length[0],
+		              pv[0][0]);
+	}
+}
+
+void search_poststatus()
+{
+	char line[SEARCHER_POST_SIZE];
+	char *movestr;
+	int left;
+
+	/* a preliminary IID search at the root can count some moves twice */
+	left = root_total - root_searched;
+	if (left < 0)
+	{
+		left = 0;
+	}
+	movestr = move_tostring(root_move);
+	snprintf(line, SEARCHER_POST_SIZE-1, "stat01: %u %lu %d %d %d %s",
+	         status_elapsed / 10, status_nodes, status_depth,
+	         left, root_total, root_move ? movestr : "");
+	free(movestr);
+	output_xboard(line);
+}
+
+/**
+ * How many legal moves there are from a position
+ */
+static int search_countlegal(board_t *board)
+{
+	movelist_t moves;
+	move_t move;
+	int color = board->tomove;
+	int count = 0;
+
+	board_generatemoves(board, &moves);
+	while (!movelist_isempty(&moves))
+	{
+		move = movelist_remove_max(&moves);
+		board_applymove(board, move);
+		if (!board_colorincheck(board, color))
+		{
+			count++;
+		}
+		board_undomove(board, move);
+	}
+	movelist_destroy(&moves);
+	return count;
+}
+
+void search_interrupt(unsigned char how)
+{
+	__sync_fetch_and_add(&interrupts[how], 1);
+}
+
+void search_resume(unsigned char how)
+{
+	__sync_fetch_and_sub(&interrupts[how], 1);
+}
+
+unsigned char search_interrupted()
+{
+	return interrupts[SEARCH_ABORT] ? SEARCH_ABORT :
+	       interrupts[SEARCH_MOVENOW] ? SEARCH_MOVENOW : 0;
+}
+
+void search_clear()
+{
+	#ifdef SEARCHER_USE_KILLERS
+	memset(killers, 0, sizeof(killers));
+	#endif
+	memset(history_table, 0, sizeof(history_table));
+}
+
+/**
+ * The reply we expect to our move, from the last search's principal
+ * variation. 0 if the line wasn't that long.
+ */
+move_t search_expectedreply()
+{
+	return search_reply;
+}
+
+void search_settled(unsigned int *ms, uint8_t *depth)
+{
+	*ms = settled_ms;
+	*depth = settled_depth;
+}
+
+int search_setparam(char *name, int value)
+{
+	int i;
+	for (i = 0; i < SEARCH_NUM_PARAMS; i++)
+	{
+		if (0 == strcmp(name, search_paramnames[i]))
+		{
+			search_params[i] = value;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Fill in the reduction table
+ */
+static void search_lmr_init()
+{
+	int type, depth, moves;
+	for (type = 0; type < 3; type++)
+	{
+		for (depth = 1; depth <= SEARCHER_MAX_DEPTH; depth++)
+		{
+			for (moves = 1; moves < SEARCHER_LMR_MOVES; moves++)
+			{
+				lmr_table[type][depth][moves] = (uint8_t)
+					(lmr_base[type] + (log(depth) * log(moves) /
+					                   lmr_divisor[type]));
+			}
+		}
+	}
+}
+
+/**
+ * Nudge a quiet move's history score by bonus (negative for a malus)
+ */
+static void search_history_update(unsigned char color, move_t move, int bonus)
+{
+	int16_t *h = &history_table[color][MOV_SRC(move)][MOV_DEST(move)];
+	*h += bonus - ((*h * abs(bonus)) / SEARCHER_HISTORY_MAX);
+}
+
+/**
+ * A quiet move caused a cutoff at the given depth: reward it, and penalize
+ * the quiet moves that were searched before it and didn't
+ */
+static void search_history_cutoff(unsigned char color, move_t move,
+                                  uint8_t depth, move_t *quiets,
+                                  int num_quiets)
+{
+	int i;
+	search_history_update(color, move, depth * depth);
+	for (i = 0; i < num_quiets; i++)
+	{
+		search_history_update(color, quiets[i], -(depth * depth));
+	}
+}
+
+/**
+ * Is this one of the killers at the given ply?
+ */
+static int search_iskiller(uint8_t ply, move_t move)
+{
+	#ifdef SEARCHER_USE_KILLERS
+	int i;
+	for (i = 0; i < SEARCHER_NUM_KILLERS; i++)
+	{
+		if (killers[ply][i] == move)
+		{
+			return 1;
+		}
+	}
+	#endif
+	return 0;
+}
+
+/**
+ * How many plies to take off a late quiet move's search. Killers, good
+ * history and a side that's improving its position reduce less.
+ */
+static uint8_t search_reduction(unsigned char nodetype, uint8_t depth,
+                                unsigned char movenum, unsigned char color,
+                                move_t move, unsigned char iskiller,
+                                unsigned char improving)
+{
+	int r;
+	r = lmr_table[nodetype]
+	             [(depth < SEARCHER_MAX_DEPTH) ? depth : SEARCHER_MAX_DEPTH]
+	             [(movenum < SEARCHER_LMR_MOVES) ?
+	              movenum : (SEARCHER_LMR_MOVES - 1)];
+	if (iskiller)
+	{
+		r--;
+	}
+	if (!improving)
+	{
+		r++;
+	}
+	r -= history_table[color][MOV_SRC(move)][MOV_DEST(move)] /
+	     SEARCHER_HISTORY_LMR_SCALE;
+	/* the child gets at least one ply */
+	if (r > depth - 2)
+	{
+		r = depth - 2;
+	}
+	return (r > 0) ? r : 0;
 }
 
 /**
  * Stores the nodecount in the given int pointer if it's nonnull and the alpha
  * value in the second pointer if that's nonnull.
  */
-move_t getbestmove(board_t *board, unsigned int time, int *nodecnt, int16_t *alphaval)
+move_t getbestmove(board_t *board, search_limits_t *limits, int *nodecnt, int16_t *alphaval)
 {
 	move_t result, prevresult;
+	unsigned int iteration_start, iteration_time, elapsed;
 	int16_t prevalpha;
 	int16_t window_low, window_high;
 	char *movestr;
+	int i;
 
 	/********************************************************************
 	 * Setup
 	 ********************************************************************/
+	clock_gettime(CLOCK_MONOTONIC, &search_start);
+	search_limits = limits;
+	search_pondering = limits->ponder;
+	search_limitbase = 0;
+	search_nodebase = 0;
+	poll_interval = SEARCHER_POLL_NODES;
+	if (limits->nodes && (limits->nodes < poll_interval))
+	{
+		poll_interval = limits->nodes;
+	}
+	poll_countdown = poll_interval;
 	nodes = 0;
+	qnodes = 0;
+	prevnodes = 0;
 	timeup = 0;
+	/* the last search's line is for some other position */
+	prevpv_length = 0;
+	pv_follow = 0;
+	root_move = 0;
+	root_searched = 0;
+	root_total = search_countlegal(board);
 	
 	transposition_hits = 0; transposition_misses = 0;
 	regen_hits = 0; regen_misses = 0;
 
-	lazy = 0; nonlazy = 0;
+	memset(eval_stage_exits, 0, sizeof(eval_stage_exits));
+	evalcache_hits = 0; evalcache_misses = 0;
+	rfp_prunes = 0; razor_prunes = 0; futility_prunes = 0; lmp_prunes = 0;
+	iid_searches = 0;
+	#ifdef PROFILE_CYCLES
+	memset(profile_cycles, 0, sizeof(profile_cycles));
+	memset(profile_calls, 0, sizeof(profile_calls));
+	profile_searchstart = profile_rdtsc();
+	#endif
 	
 	#ifdef SEARCHER_USE_KILLERS
 	/* clear all killers */
 	memset(killers, 0, sizeof(killers));
 	#endif
+	/* old history still says something about this position, but let the
+	 * new search's cutoffs take over quickly */
+	for (i = 0; i < 2 * 64 * 64; i++)
+	{
+		((int16_t *)history_table)[i] /= 2;
+	}
+	pthread_once(&lmr_initialized, search_lmr_init);
 	/********************************************************************
 	 * Searching
 	 ********************************************************************/
+	if (search_pondering)
+	{
+		snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Pondering");
+	}
+	else
+	{
+		snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Will search for %u ms (at most %u ms)",
+		         limits->soft_ms, limits->hard_ms);
+	}
+	output(outbuf);
 	/* preliminary search */
-	cur_searching_depth = SEARCHER_MIN_DEPTH;
+	first_depth = SEARCHER_MIN_DEPTH;
+	if (limits->depth && (limits->depth < first_depth))
+	{
+		first_depth = limits->depth;
+	}
+	cur_searching_depth = first_depth;
+	iteration_start = 0;
 	result = alphabeta(board, -SEARCHER_INFINITY, SEARCHER_INFINITY,
 	                          cur_searching_depth, 0, 0, 0, 0, PV);
+	/* cut short (see search_polltime) - the best root move so far will
+	 * have to do */
+	if (timeup)
+	{
+		result = pv_length[0] ? pv[0][0] : 0;
+		lastval = root_value;
+	}
 	prevresult = result;
 	prevalpha = lastval;
 	
-	/* start the iterative timer */
-	signal(SIGALRM, sigalrm_handler);
-	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Will search for %u seconds",
-	         time);
-	output(outbuf);
-	alarm(time);
-	
 	while (!timeup && cur_searching_depth < SEARCHER_MAX_DEPTH)
 	{
+		/* a new mind, or the first one */
+		if ((result != prevresult) ||
+		    (cur_searching_depth == first_depth))
+		{
+			settled_ms = search_elapsed();
+			settled_depth = cur_searching_depth;
+		}
 		/* These guys store the result of the previous depth in case
  		 * our next search times up */
 		prevresult = result;
 		prevalpha = lastval;
+		memcpy(prevpv, pv[0], sizeof(prevpv));
+		prevpv_length = pv_length[0];
+		if (search_post)
+		{
+			search_postpv(cur_searching_depth, lastval, prevpv,
+			              prevpv_length, result);
+		}
 
 		// Don't waste time if we have a mate
 		/*if (lastval >= SEARCHER_MATE)
@@ -190,8 +736,6 @@ move_t getbestmove(board_t *board, unsigned int time, int *nodecnt, int16_t *alp
 			break;
 		}*/
 		
-		//TODO: Check if we've used up enough time to not even bother with the next search
-
 		/* advance to the next depth */
 		movestr = move_tostring(result);
 		snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Depth %d gives %s for %d. \t(nodes %d)\t",
@@ -212,11 +756,37 @@ move_t getbestmove(board_t *board, unsigned int time, int *nodecnt, int16_t *alp
 		}
 		output(outbuf);
 		free(movestr);
+
+		/* don't bother with the next search if we're out of time, or
+		 * if it would likely get cut off before finishing */
+		iteration_time = search_elapsed() - iteration_start;
+		elapsed = search_limitelapsed();
+		if (limits->depth && (cur_searching_depth >= limits->depth))
+		{
+			snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Depth limit reached");
+			output(outbuf);
+			break;
+		}
+		if (!search_pondering &&
+		    ((elapsed >= limits->soft_ms) ||
+		     (elapsed + (iteration_time * SEARCHER_ITERATION_GROWTH) >=
+		      limits->hard_ms)))
+		{
+			snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Stopping after depth %d at %u ms (last iteration took %u ms)",
+			         cur_searching_depth, elapsed, iteration_time);
+			output(outbuf);
+			break;
+		}
+		iteration_start += iteration_time;
+
 		cur_searching_depth++;
+		prevnodes += nodes + qnodes;
 		nodes = 0;
+		qnodes = 0;
 		
 		window_low  = prevalpha - SEARCHER_ASPIRATION_1;
 		window_high = prevalpha + SEARCHER_ASPIRATION_1;
+		pv_follow = 1;
 		result = alphabeta(board, window_low, window_high,
 		                   cur_searching_depth, 0, 0, 0, 0, PV);
 		if (timeup) break;
@@ -233,6 +803,7 @@ move_t getbestmove(board_t *board, unsigned int time, int *nodecnt, int16_t *alp
 			window_low  = prevalpha - SEARCHER_ASPIRATION_2;
 			window_high = prevalpha + SEARCHER_ASPIRATION_2;
 			/* re-search */
+			pv_follow = 1;
 			result = alphabeta(board, window_low, window_high,
 			                   cur_searching_depth, 0, 0, 0, 0, PV);
 		}
@@ -249,6 +820,7 @@ move_t getbestmove(board_t *board, unsigned int time, int *nodecnt, int16_t *alp
 			window_low  = -SEARCHER_INFINITY;
 			window_high =  SEARCHER_INFINITY;
 			/* re-search */
+			pv_follow = 1;
 			result = alphabeta(board, window_low, window_high,
 			                   cur_searching_depth, 0, 0, 0, 0, PV);
 		}
@@ -261,39 +833,94 @@ move_t getbestmove(board_t *board, unsigned int time, int *nodecnt, int16_t *alp
 	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Move %s gives us score %d",
 	         movestr, prevalpha);
 	output(outbuf);
-	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Nodes %d on final depth, hit/miss: trans %d/%d, regen %d/%d",
-	         nodes, transposition_hits, transposition_misses, regen_hits, regen_misses);
+	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Nodes %d (quiescent %d) on final depth, hit/miss: trans %d/%d, regen %d/%d",
+	         nodes, qnodes, transposition_hits, transposition_misses, regen_hits, regen_misses);
+	output(outbuf);
+	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Evaluations stopped after material %d, pawns %d, full %d, hit/miss: eval cache %d/%d",
+	         eval_stage_exits[EVAL_STAGE_MATERIAL],
+	         eval_stage_exits[EVAL_STAGE_PAWNS],
+	         eval_stage_exits[EVAL_STAGE_FULL], evalcache_hits,
+	         evalcache_misses);
 	output(outbuf);
-	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Lazy evaluations %d, full evaluations %d",
-	         lazy, nonlazy);
+	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Pruned by reverse futility %d, razoring %d, futility %d, move count %d",
+	         rfp_prunes, razor_prunes, futility_prunes, lmp_prunes);
 	output(outbuf);
+	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Internal iterative deepening searches %d",
+	         iid_searches);
+	output(outbuf);
+	#ifdef PROFILE_CYCLES
+	search_profilereport(profile_rdtsc() - profile_searchstart);
+	#endif
 	free(movestr);
 	#ifdef SEARCHER_USE_KILLERS
 	/* clear killers, just in case */
 	memset(killers, 0, sizeof(killers));
 	#endif
-	alarm(0);
-	signal(SIGALRM, SIG_IGN);
 	if (nodecnt != NULL)
 	{
-		*nodecnt = nodes;
+		*nodecnt = prevnodes + nodes + qnodes;
 	}
 	if (alphaval != NULL)
 	{
 		*alphaval = prevalpha;
 	}
+	search_reply = (prevpv_length > 1) ? prevpv[1] : 0;
 	return prevresult;
 }
 
+int16_t search_quiesce(board_t *board)
+{
+	/* nothing but an abort stops it */
+	static search_limits_t unlimited = { UINT_MAX, UINT_MAX, 0, 0, 0, 0, 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &search_start);
+	search_limits = &unlimited;
+	search_pondering = 0;
+	search_limitbase = 0;
+	search_nodebase = 0;
+	poll_interval = SEARCHER_POLL_NODES;
+	poll_countdown = poll_interval;
+	cur_searching_depth = 0;
+	nodes = 0;
+	qnodes = 0;
+	prevnodes = 0;
+	timeup = 0;
+	return quiesce(board, -SEARCHER_INFINITY, SEARCHER_INFINITY, 0);
+}
+
+#ifdef PROFILE_CYCLES
+/**
+ * Where the search's cycles went, by timer: share of the total, calls, and
+ * cycles per call
+ */
+static void search_profilereport(uint64_t total)
+{
+	int i;
+	snprintf(outbuf, BUF_SIZE-1, "SEARCHER: Cycles %llu, by phase (each including what it calls):",
+	         (unsigned long long)total);
+	output(outbuf);
+	for (i = 0; i < PROFILE_NUM_TIMERS; i++)
+	{
+		snprintf(outbuf, BUF_SIZE-1, "SEARCHER:   %-13s %5.1f%% %10lu calls %8llu cycles each",
+		         profile_names[i],
+		         total ? (100.0 * profile_cycles[i] / total) : 0.0,
+		         profile_calls[i],
+		         profile_calls[i] ? (unsigned long long)(profile_cycles[i] / profile_calls[i]) : 0ULL);
+		output(outbuf);
+	}
+}
+#endif
+
 /**
- * Alpha-beta search, with trans table, check extension, futility pruning
+ * Alpha-beta search, with trans table, check extension, null move, pruning
+ * and reductions
  * board      - the current node's position
  * alpha      - lower bound
  * beta       - upper bound
  * depth      - how deep we will search this node
  * ply        - how far this position is from the board's real position (used
  *              because depth can change based on extensions/reductions)
- * prevmove   - the move that was just made (used in futility pruning)
+ * prevmove   - the move that was just made (used in late move reductions)
  * num_checks - how many checks have occurred so far in the search (used for
  *              check extension)
  * nodetype   - what type of node we're searching - PV, CUT, or ALL
@@ -318,8 +945,40 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 	move_t bestmove;
 	
 	int killer_index;
+	/* still on the previous iteration's principal variation? */
+	unsigned char onpv;
+	/* for the depth-limited pruning rules */
+	unsigned char incheck, prunable;
+	int16_t staticeval;
+	/* for late move reductions */
+	unsigned char improving;
+	uint8_t reduction;
+	move_t quiets[SEARCHER_MAX_QUIETS];
+	int num_quiets;
 	
+	/* only the parent's PV move may pass this on, so take it right away */
+	onpv = pv_follow && (ply < prevpv_length);
+	pv_follow = 0;
+	if (ply < SEARCHER_MAX_DEPTH)
+	{
+		pv_length[ply] = ply;
+	}
+
+	/* keep track of where the root is, for the status command. a child
+	 * searched again (after a reduction, say) is still the same move */
+	if ((ply == 0) && !root_iid)
+	{
+		root_move = 0;
+		root_searched = 0;
+	}
+	else if ((ply == 1) && !root_iid && (prevmove != root_move))
+	{
+		root_move = prevmove;
+		root_searched++;
+	}
+
 	nodes++;
+	search_polltime();
 	if (timeup)
 	{
 		return 0;
@@ -338,6 +997,23 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		lastval = SEARCHER_DRAW_SCORE;
 		return 0;
 	}
+	/* so is a KP vs K the bitbase says is drawn, however far the pawn is
+	 * from promoting. wins still get searched, so we make progress */
+	if ((ply > 0) && bitbase_kpk_draw(board))
+	{
+		lastval = SEARCHER_DRAW_SCORE;
+		return 0;
+	}
+	/********************************************************************
+	 * terminal condition - search depth ran out
+	 ********************************************************************/
+	/* quiescence does its own transposition table work, and stores its
+	 * results with the proper bound flags, so go there right away */
+	if (depth == 0)
+	{
+		lastval = quiesce(board, alpha, beta, ply);
+		return 0;
+	}
 	/********************************************************************
 	 * check transposition table
 	 ********************************************************************/
@@ -347,7 +1023,8 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		if (TRANS_SEARCHDEPTH(trans_data) >= depth &&
 		    TRANS_REPS(trans_data) >= board->reps)
 		{
-			int16_t storedval = TRANS_VALUE(trans_data);
+			int16_t storedval = VALUE_FROM_TRANS(TRANS_VALUE(trans_data),
+			                                     ply);
 			
 			/* direct hit! */
 			if (TRANS_FLAG(trans_data) == TRANS_FLAG_EXACT)
@@ -405,48 +1082,56 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		bestmove = (move_t)0;
 		transposition_misses++;
 	}
+	/* the last iteration's line beats whatever the table says */
+	if (onpv)
+	{
+		bestmove = prevpv[ply];
+	}
 	/********************************************************************
-	 * terminal condition - search depth ran out
-	 * futility pruning done here
+	 * Depth-limited pruning - near the horizon, a static eval far enough
+	 * outside the window is trusted. Never on the PV, in check, or when
+	 * there's a mate score at stake.
 	 ********************************************************************/
-	if (depth == 0)
+	incheck = board_incheck(board);
+	/* a side in check has no static value; otherwise we'll see whether
+	 * it's better than two plies ago */
+	staticeval = incheck ? SEARCHER_NO_EVAL : eval(board);
+	if (ply <= SEARCHER_MAX_DEPTH)
+	{
+		evalstack[ply] = staticeval;
+	}
+	improving = incheck || (ply < 2) || (ply > SEARCHER_MAX_DEPTH) ||
+	            (evalstack[ply-2] == SEARCHER_NO_EVAL) ||
+	            (staticeval > evalstack[ply-2]);
+	prunable = (nodetype != PV) && !incheck &&
+	           !VALUE_ISMATE(alpha) && !VALUE_ISMATE(beta);
+	/* reverse futility (static null move): even giving back the margin we
+	 * stay above beta. like null move, zugzwang makes this unsafe in the
+	 * endgame */
+	if (prunable && (depth <= PARAM(RFP_DEPTH)) && !eval_isendgame(board) &&
+	    (staticeval - (PARAM(RFP_MARGIN) * depth) >= beta))
+	{
+		rfp_prunes++;
+		lastval = staticeval - (PARAM(RFP_MARGIN) * depth);
+		return 0;
+	}
+	/* razoring: so far below alpha that only tactics could save us, so
+	 * let quiescence look for them and believe it if it fails low too */
+	if (prunable && (depth <= PARAM(RAZOR_DEPTH)) &&
+	    (staticeval + (PARAM(RAZOR_MARGIN) * depth) <= alpha))
 	{
-		lastval = quiesce(board, alpha, beta);
-		/* we time up in the middle of quiescence and get zero, and go
-		 * to add it in the trans table, OH SHI-- */
+		int16_t qval = quiesce(board, alpha, alpha+1, ply);
 		if (timeup)
 		{
 			return 0;
 		}
-		/* if we already have an entry, and this is an end condition,
-		 * we don't want to replace our better entry */
-		if (!trans_data_valid(trans_data))
+		if (qval <= alpha)
 		{
-			trans_add(board->hash, (move_t)0, board->reps, lastval,
-				  (board->moves - cur_searching_depth),
-			          board->moves, 0, TRANS_FLAG_EXACT);
-		}
-		return 0;
-	}
-	#ifdef SEARCHER_FUTILITY_PRUNING
-	/* futility pruning - prune only 1 and 2 plies from the horizon */
-	else if (depth < 3)
-	{
-		/* if we're in check or possibly in a capture sequence, trying
-		 * to prune will be too dangerous */
-		if (!(board_incheck(board) || MOV_CAPT(prevmove)))
-		{
-			int16_t score = eval_lazy(board);
-			/* check how far we are from the window */
-			if ((score + futility_margin[depth] < alpha) ||
-			    (score - futility_margin[depth] > beta))
-			{
-				lastval = quiesce(board, alpha, beta);
-				return 0;
-			}
+			razor_prunes++;
+			lastval = qval;
+			return 0;
 		}
 	}
-	#endif
 	/********************************************************************
 	 * Null-move pruning
 	 ********************************************************************/
@@ -458,7 +1143,7 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 	 *	we're not in check
 	 */
 	if ((nodetype != PV) && (depth > 3) && !eval_isendgame(board) &&
-	    (eval_lazy(board) >= beta) && !board_incheck(board))
+	    (eval_lazy(board) >= beta) && !incheck)
 	{
 		/* make null move */
 		board_applymove(board, 0);
@@ -480,6 +1165,36 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 			null_extended = 1;
 		}
 	}
+	/********************************************************************
+	 * Internal iterative deepening
+	 ********************************************************************/
+	/* nothing from the table to try first; at a node where we expect to
+	 * search more than one move, the static ordering could cost a lot.
+	 * a shallower search of this same node finds a good first move */
+	if (!bestmove && (nodetype != ALL) && (depth >= SEARCHER_IID_DEPTH))
+	{
+		iid_searches++;
+		if (ply == 0)
+		{
+			root_iid = 1;
+		}
+		bestmove = alphabeta(board, alpha, beta,
+		                     depth - SEARCHER_IID_REDUCTION, ply, prevmove,
+		                     num_checks, null_extended, nodetype);
+		if (ply == 0)
+		{
+			root_iid = 0;
+		}
+		if (timeup)
+		{
+			return 0;
+		}
+		/* that search's line isn't ours */
+		if (ply < SEARCHER_MAX_DEPTH)
+		{
+			pv_length[ply] = ply;
+		}
+	}
 	/********************************************************************
 	 * Main iteration over all the moves
 	 ********************************************************************/
@@ -488,17 +1203,21 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 	children_searched = 0;
 	returnmove = 0;
 	trans_flag = TRANS_FLAG_ALPHA;
+	num_quiets = 0;
 	/* and we're ready to go - first do hash move and killers */
 	if (bestmove)
 	{
 		board_applymove(board, bestmove);
 		/* if this puts us in check something's really wrong... */
 		assert(!board_colorincheck(board, color));
+		pv_follow = onpv;
 		/* check extension - if this checks the opp king */
 		if (board_incheck(board))
 		{
-			/* only extend search if >1 checks in tree */
-			if (num_checks)
+			/* only extend search if >1 checks in tree, and not
+			 * at the horizon - quiescence searches all the
+			 * evasions, so it'll find the mate if there is one */
+			if (num_checks && depth > 1)
 			{
 				alphabeta(board, -beta, -alpha, depth, ply+1,
 				          bestmove, num_checks+1, null_extended,
@@ -520,17 +1239,32 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		board_undomove(board, bestmove);
 		children_searched++;
 
-		if (-lastval > alpha)
+		/* a child that got cut off has no score to give */
+		if ((-lastval > alpha) && !timeup)
 		{
 			alpha = -lastval;
 			returnmove = bestmove;
+			search_updatepv(ply, bestmove);
+			if (ply == 0)
+			{
+				root_value = alpha;
+			}
 			trans_flag = TRANS_FLAG_EXACT;
 		}
 		if (alpha >= beta)
 		{
 			trans_flag = TRANS_FLAG_BETA;
+			if (SEARCHER_QUIET(bestmove))
+			{
+				search_history_cutoff(color, bestmove, depth,
+				                      quiets, num_quiets);
+			}
 			goto alphabeta_after_iteration;
 		}
+		if (SEARCHER_QUIET(bestmove))
+		{
+			quiets[num_quiets++] = bestmove;
+		}
 	}
 	#ifdef SEARCHER_USE_KILLERS
 	/* no cutoff from the bestmove (or no bestmove); let's try killers */
@@ -544,6 +1278,11 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		{
 			break;
 		}
+		/* already searched it */
+		if (killer == bestmove)
+		{
+			continue;
+		}
 		killerpiece = MOV_PIECE(killer);
 		killersrc = MOV_SRC(killer);
 		killerdest = MOV_DEST(killer);
@@ -592,8 +1331,10 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		/* check extension - if this checks the opp king */
 		if (board_incheck(board))
 		{
-			/* only extend search if >1 checks in tree */
-			if (num_checks)
+			/* only extend search if >1 checks in tree, and not
+			 * at the horizon - quiescence searches all the
+			 * evasions, so it'll find the mate if there is one */
+			if (num_checks && depth > 1)
 			{
 				alphabeta(board, -beta, -alpha, depth, ply+1,
 				          killer, num_checks+1, null_extended,
@@ -606,6 +1347,24 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 					  childnodetype[nodetype][!!children_searched]);
 			}
 		}
+		/* late move reductions, as below; it takes a killer a while
+		 * to come up late enough, though */
+		else if ((children_searched >= lmr_movecount[nodetype]) &&
+		         (depth > 2) && !incheck && !MOV_CAPT(prevmove) &&
+		         (reduction = search_reduction(nodetype, depth,
+		                                       children_searched, color,
+		                                       killer, 1, improving)))
+		{
+			alphabeta(board, -beta, -alpha, depth-1-reduction, ply+1,
+			          killer, num_checks, null_extended,
+			          childnodetype[nodetype][1]);
+			if (-lastval > alpha)
+			{
+				alphabeta(board, -beta, -alpha, depth-1, ply+1,
+				          killer, num_checks, null_extended,
+				          childnodetype[nodetype][1]);
+			}
+		}
 		else /* no extensions, regular search */
 		{
 			alphabeta(board, -beta, -alpha, depth-1, ply+1,
@@ -615,17 +1374,25 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		board_undomove(board, killer);
 		children_searched++;
 		
-		if (-lastval > alpha)
+		if ((-lastval > alpha) && !timeup)
 		{
 			alpha = -lastval;
 			returnmove = killer;
+			search_updatepv(ply, killer);
+			if (ply == 0)
+			{
+				search_rootchange(alpha, beta);
+			}
 			trans_flag = TRANS_FLAG_EXACT;
 		}
 		if (alpha >= beta)
 		{
 			trans_flag = TRANS_FLAG_BETA;
+			search_history_cutoff(color, killer, depth, quiets,
+			                      num_quiets);
 			goto alphabeta_after_iteration;
 		}
+		quiets[num_quiets++] = killer;
 	}
 	#endif
 	/* okay, no beta cutoff; let's continue... */
@@ -637,6 +1404,11 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 			break;
 		}
 		curmove = movelist_remove_max(&moves);
+		/* the hash move and killers were tried already */
+		if ((curmove == bestmove) || search_iskiller(ply, curmove))
+		{
+			continue;
+		}
 		
 		board_applymove(board, curmove);
 		/* see if this move puts us in check */
@@ -645,11 +1417,35 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 			board_undomove(board, curmove);
 			continue;
 		}
+		/* quiet moves that don't give check, once we have a score
+		 * from something else: futility pruning skips them if even
+		 * the margin wouldn't get us to alpha, late move pruning if
+		 * the ordering put them this far back */
+		if (prunable && (children_searched > 0) && !MOV_CAPT(curmove) &&
+		    !MOV_PROM(curmove) && !board_incheck(board))
+		{
+			if ((depth <= PARAM(FUTILITY_DEPTH)) &&
+			    (staticeval + (PARAM(FUTILITY_MARGIN) * depth) <= alpha))
+			{
+				board_undomove(board, curmove);
+				futility_prunes++;
+				continue;
+			}
+			if ((depth <= PARAM(LMP_DEPTH)) &&
+			    (children_searched >= PARAM(LMP_BASE) + (depth * depth)))
+			{
+				board_undomove(board, curmove);
+				lmp_prunes++;
+				continue;
+			}
+		}
 		/* check extension - if this checks the opp king */
 		if (board_incheck(board))
 		{
-			/* only extend search if >1 checks in tree */
-			if (num_checks)
+			/* only extend search if >1 checks in tree, and not
+			 * at the horizon - quiescence searches all the
+			 * evasions, so it'll find the mate if there is one */
+			if (num_checks && depth > 1)
 			{
 				alphabeta(board, -beta, -alpha, depth, ply+1,
 				          curmove, num_checks+1, null_extended,
@@ -675,11 +1471,17 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		 * Typically, such lines will only have one or two Late moves
 		 * in them, and we rely on the more extreme reductions on the
 		 * completely nonsense lines (1/2-depth mentioned before) to
-		 * possibly give us another ply so we find the sacrifice. */
-		else if (children_searched > lmr_movecount[nodetype] && depth > 3 &&
-		         !MOV_CAPT(curmove) && !MOV_CAPT(prevmove))
+		 * possibly give us another ply so we find the sacrifice.
+		 * How much we reduce grows with depth and lateness; see
+		 * search_reduction() for what else goes into it. */
+		else if ((children_searched >= lmr_movecount[nodetype]) &&
+		         (depth > 2) && !incheck && SEARCHER_QUIET(curmove) &&
+		         !MOV_CAPT(prevmove) &&
+		         (reduction = search_reduction(nodetype, depth,
+		                                       children_searched, color,
+		                                       curmove, 0, improving)))
 		{
-			alphabeta(board, -beta, -alpha, depth-2, ply+1,
+			alphabeta(board, -beta, -alpha, depth-1-reduction, ply+1,
 			          curmove, num_checks, null_extended,
 			          childnodetype[nodetype][1]);
 			/* oops, it fell within our window. full re-search */
@@ -699,10 +1501,15 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		board_undomove(board, curmove);
 		children_searched++;
 		
-		if (-lastval > alpha)
+		if ((-lastval > alpha) && !timeup)
 		{
 			alpha = -lastval;
 			returnmove = curmove;
+			search_updatepv(ply, curmove);
+			if (ply == 0)
+			{
+				search_rootchange(alpha, beta);
+			}
 			/* we've gotten above the bottom of the window */
 			trans_flag = TRANS_FLAG_EXACT;
 		}
@@ -710,6 +1517,11 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 		{
 			/* oops, above the top of the window */
 			trans_flag = TRANS_FLAG_BETA;
+			if (SEARCHER_QUIET(curmove))
+			{
+				search_history_cutoff(color, curmove, depth,
+				                      quiets, num_quiets);
+			}
 			#ifdef SEARCHER_USE_KILLERS
 			/* Not a killer if capture or castle */
 			if (!(MOV_CAPT(curmove)) && !(MOV_CASTLE(curmove)))
@@ -731,6 +1543,10 @@ static move_t alphabeta(board_t *board, int16_t alpha, int16_t beta,
 			#endif
 			break;
 		}
+		if (SEARCHER_QUIET(curmove) && (num_quiets < SEARCHER_MAX_QUIETS))
+		{
+			quiets[num_quiets++] = curmove;
+		}
 	}
 	movelist_destroy(&moves);
 	/* now we are done iterating; cleanup and exit this node. note, this
@@ -753,12 +1569,16 @@ alphabeta_after_iteration:
 		/* this is the "typical case" function ending
 		 * set the value so the calling function sees it properly */
 		lastval = alpha;
-		/* Don't add mates because they are depth-dependent. Don't add
-		 * draws because they are state-dependent. */
-		if (!VALUE_ISMATE(alpha) && !VALUE_ISDRAW(alpha))
+		/* Mates go in counting from this node. A draw score might come
+		 * from repeating a position from before this node, which
+		 * another path here wouldn't do - unless the last move was
+		 * irreversible, since then nothing before us can repeat (and
+		 * the fifty move count is the same for everyone) */
+		if (!VALUE_ISDRAW(alpha) || (board->halfmoves == 0))
 		{
 			/* update the trans table - here we always replace */
-			trans_add(board->hash, returnmove, board->reps, alpha,
+			trans_add(board->hash, returnmove, board->reps,
+			          VALUE_TO_TRANS(alpha, ply),
 			          (board->moves + depth - cur_searching_depth),
 			          board->moves, depth, trans_flag);
 		}
@@ -774,10 +1594,13 @@ alphabeta_after_iteration:
 		{
 			lastval = 0;
 		}
-		/* DON'T add to the transposition table here... this can screw
-		 * up which mates are sooner and cause 3-rep draws - besides,
-		 * if a mate is coming up and we've seen it there's no use
-		 * trying to search deeper/faster */
+		/* mate and stalemate don't depend on how we got here or how
+		 * deep we look, so this entry is good for any search */
+		trans_add(board->hash, 0, board->reps,
+		          VALUE_TO_TRANS(lastval, ply),
+		          (board->moves + depth - cur_searching_depth),
+		          board->moves, TRANS_SEARCHDEPTH_TERMINAL,
+		          TRANS_FLAG_EXACT);
 		return 0;
 	}
 	/* and we're done */
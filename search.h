@@ -23,15 +23,149 @@
 #include "board.h"
 #include "util/hashmap_u64_int.h"
 
+/* Constants for the search algorithm - shared with quiescence, which can
+ * find mates too */
+#define SEARCHER_INFINITY 32767
+#define SEARCHER_MATE 16383
+#define SEARCHER_MAX_DEPTH 63
+
+/* a mate score is SEARCHER_MATE less the ply the mate happens at; extensions
+ * and quiescence can take that past SEARCHER_MAX_DEPTH, so leave some room */
+#define SEARCHER_MATE_BOUND (SEARCHER_MATE - (2 * SEARCHER_MAX_DEPTH))
+#define VALUE_ISMATE(v) (((v) >= SEARCHER_MATE_BOUND) || ((v) <= -SEARCHER_MATE_BOUND))
+
+/* Mate scores count plies from the root, but the trans table sees the same
+ * position at different plies - so they go in counting from the stored node,
+ * and come back out counting from the root of whoever finds them. */
+#define VALUE_TO_TRANS(v, ply) \
+	(((v) >= SEARCHER_MATE_BOUND) ? ((v) + (ply)) : \
+	 ((v) <= -SEARCHER_MATE_BOUND) ? ((v) - (ply)) : (v))
+#define VALUE_FROM_TRANS(v, ply) \
+	(((v) >= SEARCHER_MATE_BOUND) ? ((v) - (ply)) : \
+	 ((v) <= -SEARCHER_MATE_BOUND) ? ((v) + (ply)) : (v))
+
+/**
+ * How long a search may take, in milliseconds since it started. Past the soft
+ * limit no new iteration is started, nor is one that doesn't look like it can
+ * finish before the hard limit; at the hard limit the search is abandoned and
+ * the last complete iteration's move is used.
+ *
+ * A ponder search ignores the time limits until another thread clears the
+ * ponder flag (after setting soft_ms and hard_ms), and from then on they count
+ * from that moment instead. Setting stop from another thread aborts the
+ * search at the next clock poll.
+ *
+ * A nonzero depth stops the search once that depth is complete, whatever the
+ * clock says (the time limits still apply too). Nonzero nodes works like the
+ * hard limit, only counting nodes searched. A nonzero nps makes the time
+ * limits count nodes too, as if every nps nodes took a second, so that a
+ * search doesn't depend on how fast (or how loaded) the machine is.
+ */
+typedef struct search_limits_t {
+	unsigned int soft_ms;
+	unsigned int hard_ms;
+	uint8_t depth;
+	unsigned long nodes;
+	unsigned int nps;
+	volatile unsigned char ponder;
+	volatile unsigned char stop;
+} search_limits_t;
+
 /**
  * A search function will require the following arguments:
  * 1) Board state
- * 2) How many seconds we should think before moving
- * 3) int * - if nonnull, lets you know how many nodes were searched
+ * 2) How long we may think before moving
+ * 3) int * - if nonnull, lets you know how many nodes were searched (main
+ *            and quiescent, over all the iterations)
  * 4) int * - if nonnull, lets you know the alpha value of the position
  */
-typedef move_t (*search_fn)(board_t *, unsigned int, int *, int16_t *);
+typedef move_t (*search_fn)(board_t *, search_limits_t *, int *, int16_t *);
+
+move_t getbestmove(board_t *, search_limits_t *, int *, int16_t *);
+
+/**
+ * Just the quiescence search, with a full window, for who's to move - what
+ * the search would see at one of its leaves. For anything that wants to look
+ * at a lot of positions, like the eval tuner; each thread can call it.
+ */
+int16_t search_quiesce(board_t *);
+
+/**
+ * Called every node by the searchers; every so often it reads the clock and
+ * sets timeup once the hard limit has passed or the search has been stopped.
+ */
+void search_polltime();
+
+/**
+ * Cut short the search in progress, from another thread. SEARCH_MOVENOW stops
+ * it as soon as it has a move to answer with, as if the hard time limit had
+ * passed (a ponder search doesn't care); SEARCH_ABORT stops it outright, and
+ * its result is worthless. A request holds for any search started after it
+ * too, until the requester takes it back with search_resume() - so it can't
+ * get lost by arriving just before the search it was meant for. Requests are
+ * counted, so several can be outstanding at once. search_interrupted() tells
+ * which kind, if any, is in effect.
+ */
+#define SEARCH_MOVENOW 1
+#define SEARCH_ABORT 2
+void search_interrupt(unsigned char);
+void search_resume(unsigned char);
+unsigned char search_interrupted();
 
-move_t getbestmove(board_t *, unsigned int, int *, int16_t *);
+/**
+ * Forget the move ordering knowledge (killers and history) gathered by
+ * earlier searches, so the next one searches as if it were the first.
+ */
+void search_clear();
+
+/**
+ * The opponent's expected reply to the move the last search chose, from its
+ * principal variation; 0 if it doesn't know.
+ */
+move_t search_expectedreply();
+
+/**
+ * When the last search in this thread first chose the move it returned:
+ * how many milliseconds in, and the depth of that iteration
+ */
+void search_settled(unsigned int *, uint8_t *);
+
+/* nonzero to print xboard thinking output */
+extern unsigned char search_post;
+
+/**
+ * Answer xboard's "." with a stat01 line about the search in progress: time,
+ * nodes, depth, root moves left and in total, and the one being searched.
+ * Meant to be called from another thread while the search runs.
+ */
+void search_poststatus();
+
+/**
+ * Tunable pruning parameters, changeable at runtime. Each rule applies only
+ * below its depth parameter, so setting that to 0 turns the rule off; margins
+ * are in centipawns per ply of remaining depth.
+ */
+enum search_param {
+	/* reverse futility: static eval this far above beta fails high */
+	SEARCH_PARAM_RFP_DEPTH,
+	SEARCH_PARAM_RFP_MARGIN,
+	/* razoring: static eval this far below alpha drops into quiescence */
+	SEARCH_PARAM_RAZOR_DEPTH,
+	SEARCH_PARAM_RAZOR_MARGIN,
+	/* futility: skip quiet moves when eval plus this can't reach alpha */
+	SEARCH_PARAM_FUTILITY_DEPTH,
+	SEARCH_PARAM_FUTILITY_MARGIN,
+	/* late move pruning: skip quiet moves past base + depth^2 of them */
+	SEARCH_PARAM_LMP_DEPTH,
+	SEARCH_PARAM_LMP_BASE,
+	SEARCH_NUM_PARAMS
+};
+extern int search_params[SEARCH_NUM_PARAMS];
+extern char *search_paramnames[SEARCH_NUM_PARAMS];
+
+/**
+ * Set a pruning parameter by name. Returns 0, or -1 if there's no such name.
+ */
+int search_setparam(char *, int);
 
 #endif
@@ -0,0 +1,764 @@
+/****************************************************************************
+ * testsuite.c - tactical positions for measuring the search
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "testsuite.h"
+#include "board.h"
+#include "search.h"
+#include "transposition.h"
+#include "rand.h"
+#include "eval.h"
+
+/* any fixed seed makes the zobrist keys, and so the searches, repeatable */
+#define TESTSUITE_SEED 5489
+
+/**
+ * Positions from Win At Chess, each with its solution. These were picked to
+ * have one clearly best move that a few plies of search can find, so they
+ * show whether a pruning rule is throwing away tactics.
+ */
+typedef struct testsuite_position_t {
+	char *fen;
+	char *bestmove;
+} testsuite_position_t;
+
+static testsuite_position_t testsuite_positions[] = {
+	{ "2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R4RK1 w - -", "g3g6" },
+	{ "8/7p/5k2/5p2/p1p2P2/Pr1pPK2/1P1R3P/8 b - -", "b3b2" },
+	{ "5rk1/1ppb3p/p1pb4/6q1/3P1p1r/2P1R2P/PP1BQ1P1/5RKN w - -", "e3g3" },
+	{ "r1bq2rk/pp3pbp/2p1p1pQ/7P/3P4/2PB1N2/PP3PPR/2KR4 w - -", "h6h7" },
+	{ "5k2/6pp/p1qN4/1p1p4/3P4/2PKP2Q/PP3r2/3R4 b - -", "c6c4" },
+	{ "7k/p7/1R5K/6r1/6p1/6P1/8/8 w - -", "b6b7" },
+	{ "rnbqkb1r/pppp1ppp/8/4P3/6n1/7P/PPPNPPP1/R1BQKBNR b KQkq -", "g4e3" },
+	{ "r4q1k/p2bR1rp/2p2Q1N/5p2/5p2/2P5/PP3PPP/R5K1 w - -", "e7f7" },
+	{ "3q1rk1/p4pp1/2pb3p/3p4/6Pr/1PNQ4/P1PB1PP1/4RRK1 b - -", "d6h2" },
+	{ "2br2k1/2q3rn/p2NppQ1/2p1P3/Pp5R/4P3/1P3PPP/3R2K1 w - -", "h4h7" },
+	{ "r1b1kb1r/3q1ppp/pBp1pn2/8/Np3P2/5B2/PPP3PP/R2Q1RK1 w kq -", "f3c6" },
+	{ "4k1r1/2p3r1/1pR1p3/3pP2p/3P2qP/P4N2/1PQ4P/5R1K b - -", "g4f3" },
+	{ "5rk1/pp4p1/2n1p2p/2Npq3/2p5/6P1/P3P1BP/R4Q1K w - -", "f1f8" },
+	{ "r2rb1k1/pp1q1p1p/2n1p1p1/2bp4/5P2/PP1BPR1Q/1BPN2PP/R5K1 w - -", "h3h7" },
+	{ "1R6/1brk2p1/4p2p/p1P1Pp2/P7/6P1/1P4P1/2R3K1 w - -", "b8b7" },
+	{ "r4rk1/ppp2ppp/2n5/2bqp3/8/P2PB3/1PP1NPPP/R2Q1RK1 w - -", "e2c3" },
+	{ "R7/P4k2/8/8/8/8/r7/6K1 w - -", "a8h8" },
+};
+#define TESTSUITE_NUM_POSITIONS \
+	(sizeof(testsuite_positions) / sizeof(testsuite_positions[0]))
+
+/**
+ * Positions for the benchmark: openings, middlegames with and without the
+ * queens, and endgames down to a few pieces, so that every part of the
+ * search and the evaluator gets its share of the work.
+ */
+static char *testsuite_benchpositions[] = {
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+	"4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+	"rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+	"r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+	"r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+	"r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+	"r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+	"4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+	"2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+	"r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+	"3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+	"r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+	"4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+	"3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+	"6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 3 54",
+	"3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+	"2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+	"8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+	"7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+	"8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+	"8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+	"8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+	"8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+	"5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+	"6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+	"1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+	"6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+	"8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+	"4rrk1/1p1nq3/p7/2p1P1pp/3P2bp/3Q1Bn1/PPPB4/1K2R1NR w - - 40 21",
+	"r3k2r/3nnpbp/q2pp1p1/p7/Pp1PPPP1/4BNN1/1P5P/R2Q1RK1 w kq - 0 16",
+	"3Qb1k1/1r2ppb1/pN1n2q1/Pp1Pp1Pr/4P2p/4BP2/4B1R1/1R5K b - - 11 40",
+	"4k3/3q1r2/1N2r1b1/3ppN2/2nPP3/1B1R2n1/2R1Q3/3K4 w - - 5 1",
+	"8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+	"8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+	"8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+	"8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+	"8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+	"8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+	"6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+	"r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+};
+#define TESTSUITE_NUM_BENCHPOSITIONS \
+	(sizeof(testsuite_benchpositions) / sizeof(testsuite_benchpositions[0]))
+
+/* the rules, by the parameter that switches each one off */
+static int testsuite_rules[] = {
+	SEARCH_PARAM_RFP_DEPTH,
+	SEARCH_PARAM_RAZOR_DEPTH,
+	SEARCH_PARAM_FUTILITY_DEPTH,
+	SEARCH_PARAM_LMP_DEPTH
+};
+static char *testsuite_rulenames[] = {
+	"reverse futility", "razoring", "futility", "move count"
+};
+#define TESTSUITE_NUM_RULES \
+	(sizeof(testsuite_rules) / sizeof(testsuite_rules[0]))
+
+/**
+ * Search every position with only the rules in the mask turned on, counting
+ * nodes and solutions. Returns the milliseconds spent searching.
+ */
+static unsigned int testsuite_runconfig(uint8_t depth, unsigned int mask,
+                                        long *nodes, int *solved)
+{
+	int defaults[SEARCH_NUM_PARAMS];
+	search_limits_t limits;
+	struct timespec start, end;
+	unsigned int ms;
+	board_t *board;
+	unsigned int i;
+	int n;
+	char *movestr;
+
+	/* a depth of zero turns a rule off */
+	memcpy(defaults, search_params, sizeof(defaults));
+	for (i = 0; i < TESTSUITE_NUM_RULES; i++)
+	{
+		if (!(mask & (1 << i)))
+		{
+			search_params[testsuite_rules[i]] = 0;
+		}
+	}
+
+	*nodes = 0;
+	*solved = 0;
+	ms = 0;
+	for (i = 0; i < TESTSUITE_NUM_POSITIONS; i++)
+	{
+		board = board_init();
+		if (board_setfen(board, testsuite_positions[i].fen))
+		{
+			fprintf(stderr, "Bad test position: %s\n",
+			        testsuite_positions[i].fen);
+			board_destroy(board);
+			continue;
+		}
+		/* every configuration starts from the same empty tables */
+		trans_clear();
+		search_clear();
+		limits.soft_ms = (unsigned int)(-1);
+		limits.hard_ms = (unsigned int)(-1);
+		limits.depth = depth;
+		limits.nodes = 0;
+		limits.nps = 0;
+		limits.ponder = 0;
+		limits.stop = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		movestr = move_tostring(getbestmove(board, &limits, &n, NULL));
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ms += ((end.tv_sec - start.tv_sec) * 1000) +
+		      ((end.tv_nsec - start.tv_nsec) / 1000000);
+		*nodes += n;
+		if (0 == strcmp(movestr, testsuite_positions[i].bestmove))
+		{
+			(*solved)++;
+		}
+		free(movestr);
+		board_destroy(board);
+	}
+
+	memcpy(search_params, defaults, sizeof(defaults));
+	return ms;
+}
+
+/**
+ * Print one configuration's line of the results table. baseline is the node
+ * count with no pruning, to show the reduction against.
+ */
+static void testsuite_report(char *name, long nodes, int solved,
+                             unsigned int ms, long baseline)
+{
+	printf("%-18s %12ld %6.1f%% %5d/%-3d %8u ms\n", name, nodes,
+	       (baseline > 0) ? (100.0 * (baseline - nodes) / baseline) : 0.0,
+	       solved, (int)TESTSUITE_NUM_POSITIONS, ms);
+}
+
+void testsuite_run(int depth)
+{
+	long nodes, baseline;
+	int solved;
+	unsigned int i, ms;
+
+	if (depth < 1 || depth >= SEARCHER_MAX_DEPTH)
+	{
+		fprintf(stderr, "Depth %d is out of range (1 to %d), using %d\n",
+		        depth, SEARCHER_MAX_DEPTH - 1, TESTSUITE_DEFAULT_DEPTH);
+		depth = TESTSUITE_DEFAULT_DEPTH;
+	}
+	/* before the first board makes the zobrist keys */
+	rand_seed(TESTSUITE_SEED);
+	printf("Searching %d positions to depth %d\n",
+	       (int)TESTSUITE_NUM_POSITIONS, depth);
+	printf("%-18s %12s %7s %9s %11s\n", "rules", "nodes", "saved",
+	       "solved", "time");
+
+	ms = testsuite_runconfig(depth, 0, &baseline, &solved);
+	testsuite_report("none", baseline, solved, ms, baseline);
+	for (i = 0; i < TESTSUITE_NUM_RULES; i++)
+	{
+		ms = testsuite_runconfig(depth, 1 << i, &nodes, &solved);
+		testsuite_report(testsuite_rulenames[i], nodes, solved, ms,
+		                 baseline);
+	}
+	ms = testsuite_runconfig(depth, (1 << TESTSUITE_NUM_RULES) - 1,
+	                         &nodes, &solved);
+	testsuite_report("all", nodes, solved, ms, baseline);
+}
+
+void testsuite_bench(uint8_t depth)
+{
+	search_limits_t limits;
+	struct timespec start, end;
+	unsigned long ms;
+	long nodes;
+	board_t *board;
+	unsigned int i;
+	int n;
+
+	if (depth < 1 || depth >= SEARCHER_MAX_DEPTH)
+	{
+		depth = TESTSUITE_BENCH_DEPTH;
+	}
+	/* before the first board makes the zobrist keys */
+	rand_seed(TESTSUITE_SEED);
+	nodes = 0;
+	ms = 0;
+	for (i = 0; i < TESTSUITE_NUM_BENCHPOSITIONS; i++)
+	{
+		board = board_init();
+		if (board_setfen(board, testsuite_benchpositions[i]))
+		{
+			fprintf(stderr, "Bad bench position: %s\n",
+			        testsuite_benchpositions[i]);
+			board_destroy(board);
+			continue;
+		}
+		trans_clear();
+		search_clear();
+		limits.soft_ms = (unsigned int)(-1);
+		limits.hard_ms = (unsigned int)(-1);
+		limits.depth = depth;
+		limits.nodes = 0;
+		limits.nps = 0;
+		limits.ponder = 0;
+		limits.stop = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		getbestmove(board, &limits, &n, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ms += ((end.tv_sec - start.tv_sec) * 1000) +
+		      ((end.tv_nsec - start.tv_nsec) / 1000000);
+		nodes += n;
+		board_destroy(board);
+	}
+	printf("Positions:     %d (depth %d)\n",
+	       (int)TESTSUITE_NUM_BENCHPOSITIONS, depth);
+	printf("Time:          %lu ms\n", ms);
+	printf("Nodes:         %ld\n", nodes);
+	printf("Nodes/second:  %lu\n", (ms > 0) ? (nodes * 1000 / ms) : 0);
+}
+
+/* how many moves an EPD bm or am operation may list */
+#define TESTSUITE_EPD_MAX_MOVES 8
+#define TESTSUITE_EPD_LINE 1024
+
+/**
+ * A position from an EPD file, what it wants from us, and how we did
+ */
+typedef struct testsuite_epd_t {
+	char fen[TESTSUITE_EPD_LINE];
+	char id[64];
+	move_t best[TESTSUITE_EPD_MAX_MOVES];
+	int num_best;
+	move_t avoid[TESTSUITE_EPD_MAX_MOVES];
+	int num_avoid;
+	/* results */
+	move_t move;
+	unsigned char solved;
+	unsigned int ms;
+	uint8_t depth;
+	long nodes;
+} testsuite_epd_t;
+
+/**
+ * What the worker threads share: the positions, the limits for each search,
+ * and the next position nobody has taken yet
+ */
+typedef struct testsuite_epdrun_t {
+	testsuite_epd_t *positions;
+	int count;
+	unsigned int ms;
+	int depth;
+	int next;
+	pthread_mutex_t lock;
+} testsuite_epdrun_t;
+
+/**
+ * Read a bm or am operation's moves (SAN, separated by spaces) into the list.
+ * Returns -1 if one of them isn't a legal move in the position.
+ */
+static int testsuite_epdmoves(board_t *board, char *operands, move_t *list,
+                              int *count)
+{
+	char *move, *save;
+	for (move = strtok_r(operands, " ", &save); move != NULL;
+	     move = strtok_r(NULL, " ", &save))
+	{
+		if (*count == TESTSUITE_EPD_MAX_MOVES)
+		{
+			break;
+		}
+		if (!(list[*count] = move_fromsan(board, move)))
+		{
+			return -1;
+		}
+		(*count)++;
+	}
+	return 0;
+}
+
+/**
+ * Parse one line of an EPD file: the first four fields of a FEN, then
+ * operations ending in semicolons. We understand bm, am and id. Returns -1
+ * for a line we can't use.
+ */
+static int testsuite_epdparse(char *line, testsuite_epd_t *epd)
+{
+	board_t *board;
+	char *c, *op, *save;
+	int fields;
+
+	memset(epd, 0, sizeof(testsuite_epd_t));
+	/* the position, up to the fourth space */
+	for (c = line, fields = 0; *c; c++)
+	{
+		if (*c == ' ' && ++fields == 4)
+		{
+			break;
+		}
+	}
+	if (fields < 3)
+	{
+		return -1;
+	}
+	strncpy(epd->fen, line, c - line);
+	board = board_init();
+	if (board_setfen(board, epd->fen))
+	{
+		board_destroy(board);
+		return -1;
+	}
+	for (op = strtok_r(c, ";", &save); op != NULL;
+	     op = strtok_r(NULL, ";", &save))
+	{
+		while (*op == ' ')
+		{
+			op++;
+		}
+		if (0 == strncmp(op, "bm ", 3))
+		{
+			if (testsuite_epdmoves(board, op + 3, epd->best,
+			                       &epd->num_best))
+			{
+				break;
+			}
+		}
+		else if (0 == strncmp(op, "am ", 3))
+		{
+			if (testsuite_epdmoves(board, op + 3, epd->avoid,
+			                       &epd->num_avoid))
+			{
+				break;
+			}
+		}
+		else if (0 == strncmp(op, "id ", 3))
+		{
+			op += 3;
+			while (*op == ' ' || *op == '"')
+			{
+				op++;
+			}
+			strncpy(epd->id, op, sizeof(epd->id) - 1);
+			if ((c = strchr(epd->id, '"')) != NULL)
+			{
+				*c = '\0';
+			}
+		}
+	}
+	board_destroy(board);
+	/* a bad move in an operation leaves op where it stopped */
+	if (op != NULL || (epd->num_best == 0 && epd->num_avoid == 0))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Search the position, then see whether the move is one of the best moves
+ * (if there are any) and none of the ones to avoid
+ */
+static void testsuite_epdsearch(testsuite_epdrun_t *run, testsuite_epd_t *epd)
+{
+	search_limits_t limits;
+	board_t *board;
+	int i, n;
+
+	board = board_init();
+	board_setfen(board, epd->fen);
+	/* whichever positions this thread searched before shouldn't matter */
+	search_clear();
+	limits.soft_ms = run->ms ? run->ms : (unsigned int)(-1);
+	limits.hard_ms = limits.soft_ms;
+	limits.depth = run->depth;
+	limits.nodes = 0;
+	limits.nps = 0;
+	limits.ponder = 0;
+	limits.stop = 0;
+	epd->move = getbestmove(board, &limits, &n, NULL);
+	epd->nodes = n;
+	search_settled(&epd->ms, &epd->depth);
+	board_destroy(board);
+
+	epd->solved = (epd->num_best == 0);
+	for (i = 0; i < epd->num_best; i++)
+	{
+		if (epd->move == epd->best[i])
+		{
+			epd->solved = 1;
+		}
+	}
+	for (i = 0; i < epd->num_avoid; i++)
+	{
+		if (epd->move == epd->avoid[i])
+		{
+			epd->solved = 0;
+		}
+	}
+}
+
+/**
+ * Take positions off the list and search them until there are none left,
+ * printing each result as it comes
+ */
+static void *testsuite_epdworker(void *arg)
+{
+	testsuite_epdrun_t *run = (testsuite_epdrun_t *)arg;
+	testsuite_epd_t *epd;
+	char *movestr;
+	int i;
+
+	while (1)
+	{
+		pthread_mutex_lock(&run->lock);
+		i = run->next++;
+		pthread_mutex_unlock(&run->lock);
+		if (i >= run->count)
+		{
+			break;
+		}
+		epd = &run->positions[i];
+		testsuite_epdsearch(run, epd);
+		movestr = move_tostring(epd->move);
+		pthread_mutex_lock(&run->lock);
+		if (epd->solved)
+		{
+			printf("%-20s %-6s solved   %8u ms  depth %2d\n",
+			       epd->id, movestr, epd->ms, epd->depth);
+		}
+		else
+		{
+			printf("%-20s %-6s failed\n", epd->id, movestr);
+		}
+		pthread_mutex_unlock(&run->lock);
+		free(movestr);
+	}
+	return NULL;
+}
+
+int testsuite_epd(char *filename, unsigned int ms, int depth, int threads)
+{
+	testsuite_epdrun_t run;
+	pthread_t *workers;
+	struct timespec start, end;
+	char line[TESTSUITE_EPD_LINE], copy[TESTSUITE_EPD_LINE];
+	FILE *file;
+	int i, solved, size;
+	unsigned long solvetime, wall;
+	long nodes;
+
+	if (depth < 0 || depth >= SEARCHER_MAX_DEPTH)
+	{
+		fprintf(stderr, "Depth %d is out of range (1 to %d)\n", depth,
+		        SEARCHER_MAX_DEPTH - 1);
+		return -1;
+	}
+	if ((file = fopen(filename, "r")) == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+	if (ms == 0 && depth == 0)
+	{
+		ms = TESTSUITE_EPD_TIME;
+	}
+	/* before the first board makes the zobrist keys */
+	rand_seed(TESTSUITE_SEED);
+	run.positions = NULL;
+	run.count = 0;
+	size = 0;
+	while (fgets(line, TESTSUITE_EPD_LINE, file))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+		{
+			continue;
+		}
+		if (run.count == size)
+		{
+			size = size ? (size * 2) : 64;
+			run.positions = realloc(run.positions,
+			                        size * sizeof(testsuite_epd_t));
+		}
+		/* parsing chops the line up */
+		strcpy(copy, line);
+		if (testsuite_epdparse(line, &run.positions[run.count]))
+		{
+			fprintf(stderr, "Skipping EPD line: %s\n", copy);
+			continue;
+		}
+		if (run.positions[run.count].id[0] == '\0')
+		{
+			snprintf(run.positions[run.count].id,
+			         sizeof(run.positions[run.count].id), "#%d",
+			         run.count + 1);
+		}
+		run.count++;
+	}
+	fclose(file);
+
+	printf("Searching %d positions", run.count);
+	if (ms)
+	{
+		printf(" for %u ms", ms);
+	}
+	if (depth)
+	{
+		printf(" to depth %d", depth);
+	}
+	printf(", %d at a time\n", threads);
+	/* the searches share the trans table, so start it out empty once */
+	trans_clear();
+	run.ms = ms;
+	run.depth = depth;
+	run.next = 0;
+	pthread_mutex_init(&run.lock, NULL);
+	workers = malloc(threads * sizeof(pthread_t));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < threads; i++)
+	{
+		if (pthread_create(&workers[i], NULL, testsuite_epdworker, &run))
+		{
+			threads = i;
+			break;
+		}
+	}
+	/* no threads at all, we'll do it ourselves */
+	if (threads == 0)
+	{
+		testsuite_epdworker(&run);
+	}
+	for (i = 0; i < threads; i++)
+	{
+		pthread_join(workers[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wall = ((end.tv_sec - start.tv_sec) * 1000) +
+	       ((end.tv_nsec - start.tv_nsec) / 1000000);
+
+	solved = 0;
+	solvetime = 0;
+	nodes = 0;
+	for (i = 0; i < run.count; i++)
+	{
+		nodes += run.positions[i].nodes;
+		if (run.positions[i].solved)
+		{
+			solved++;
+			solvetime += run.positions[i].ms;
+		}
+	}
+	printf("Solved:        %d/%d\n", solved, run.count);
+	printf("Time to solve: %lu ms total, %lu ms average\n", solvetime,
+	       solved ? (solvetime / solved) : 0);
+	printf("Nodes:         %ld\n", nodes);
+	printf("Wall time:     %lu ms\n", wall);
+
+	pthread_mutex_destroy(&run.lock);
+	free(workers);
+	free(run.positions);
+	return 0;
+}
+
+/* for the eval speed comparison: how many random games from each bench
+ * position, and how long each one goes */
+#define TESTSUITE_NNUE_GAMES 256
+#define TESTSUITE_NNUE_PLIES 32
+
+/**
+ * Pick a random legal move, or 0 if there isn't one
+ */
+static move_t testsuite_randommove(board_t *board)
+{
+	movelist_t moves;
+	move_t legal[256];
+	move_t move;
+	int n = 0;
+
+	movelist_init(&moves);
+	board_generatemoves(board, &moves);
+	while (!movelist_isempty(&moves) && (n < 256))
+	{
+		move = movelist_remove_max(&moves);
+		board_applymove(board, move);
+		if (!board_colorincheck(board, OTHERCOLOR(board->tomove)))
+		{
+			legal[n++] = move;
+		}
+		board_undomove(board, move);
+	}
+	movelist_destroy(&moves);
+	return n ? legal[rand32() % n] : 0;
+}
+
+/**
+ * Play the same random games as every other call, evaluating each position
+ * along the way if asked. Returns how long it took, in microseconds, and
+ * counts the positions.
+ */
+static unsigned long testsuite_randomgames(int evaluate, long *positions)
+{
+	struct timespec start, end;
+	unsigned long us = 0;
+	volatile int16_t sink;
+	board_t *board;
+	move_t move;
+	unsigned int i;
+	int game, ply;
+
+	rand_seed(TESTSUITE_SEED);
+	*positions = 0;
+	for (i = 0; i < TESTSUITE_NUM_BENCHPOSITIONS; i++)
+	{
+		for (game = 0; game < TESTSUITE_NNUE_GAMES; game++)
+		{
+			board = board_init();
+			if (board_setfen(board, testsuite_benchpositions[i]))
+			{
+				board_destroy(board);
+				break;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (ply = 0; ply < TESTSUITE_NNUE_PLIES; ply++)
+			{
+				move = testsuite_randommove(board);
+				if (move == 0)
+				{
+					break;
+				}
+				board_applymove(board, move);
+				if (evaluate)
+				{
+					sink = eval(board);
+				}
+				(*positions)++;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			us += ((end.tv_sec - start.tv_sec) * 1000000) +
+			      ((end.tv_nsec - start.tv_nsec) / 1000);
+			board_destroy(board);
+		}
+	}
+	(void)sink;
+	return us;
+}
+
+/**
+ * Evaluations per second with whichever evaluator is in use, not counting
+ * the time to play the moves
+ */
+static void testsuite_evalspeed(char *name, unsigned long baseline)
+{
+	long positions;
+	unsigned long us = testsuite_randomgames(1, &positions);
+	us = (us > baseline) ? us - baseline : 1;
+	printf("%-14s %ld positions, %lu us, %llu evals/second\n", name,
+	       positions, us,
+	       (unsigned long long)positions * 1000000 / us);
+}
+
+int testsuite_nnuebench(char *filename, uint8_t depth)
+{
+	long positions;
+	unsigned long baseline;
+
+	/* make the zobrist keys the way the bench does */
+	rand_seed(TESTSUITE_SEED);
+	board_destroy(board_init());
+	baseline = testsuite_randomgames(0, &positions);
+
+	eval_usenetwork(NULL);
+	testsuite_evalspeed("Classical:", baseline);
+	if (eval_usenetwork(filename))
+	{
+		fprintf(stderr, "Couldn't load a network from %s\n", filename);
+		return -1;
+	}
+	testsuite_evalspeed("Network:", baseline);
+
+	printf("\nBench, classical eval:\n");
+	eval_usenetwork(NULL);
+	testsuite_bench(depth);
+	printf("\nBench, network:\n");
+	eval_usenetwork(filename);
+	testsuite_bench(depth);
+	eval_usenetwork(NULL);
+	return 0;
+}
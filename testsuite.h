@@ -0,0 +1,69 @@
+/****************************************************************************
+ * testsuite.h - tactical positions for measuring the search
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#ifndef TESTSUITE_H
+#define TESTSUITE_H
+
+#include <stdint.h>
+
+#ifndef TESTSUITE_DEFAULT_DEPTH
+#define TESTSUITE_DEFAULT_DEPTH 7
+#endif
+#ifndef TESTSUITE_BENCH_DEPTH
+#define TESTSUITE_BENCH_DEPTH 7
+#endif
+/* milliseconds per position for an EPD suite, if not told otherwise */
+#ifndef TESTSUITE_EPD_TIME
+#define TESTSUITE_EPD_TIME 1000
+#endif
+
+/**
+ * Search each test position to the given depth, once with all the pruning
+ * rules off, once with each rule on by itself, and once with all of them,
+ * printing the nodes searched and positions solved for every configuration.
+ * The rules' depths and margins are whatever search_setparam() left them at.
+ */
+void testsuite_run(int depth);
+
+/**
+ * Search a fixed set of positions to the given depth, each from empty tables
+ * with the same zobrist keys every time, and print the total node count and
+ * the speed. The node count is a signature of the search: any change to what
+ * it does (as opposed to how fast) changes it.
+ */
+void testsuite_bench(uint8_t depth);
+
+/**
+ * Run the bm/am test suite in an EPD file: search each position for ms
+ * milliseconds and/or to the given depth (0 for no limit; with neither, the
+ * default time), with that many positions being searched at once on worker
+ * threads, which share the trans table. Prints whether each position was
+ * solved and how soon the search settled on the move it played, then the
+ * totals. Returns -1 if the file can't be read or the depth is out of range.
+ */
+int testsuite_epd(char *filename, unsigned int ms, int depth, int threads);
+
+/**
+ * Compare the classical eval with the network in the given file: how many
+ * positions a second each can evaluate along random games from the bench
+ * positions, and then the benchmark's speed with each. Returns -1 if the
+ * network can't be loaded.
+ */
+int testsuite_nnuebench(char *filename, uint8_t depth);
+
+#endif
@@ -17,14 +17,27 @@
  * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  ****************************************************************************/
 #include <stdlib.h>
+#include <string.h>
 #include "transposition.h"
 #include "assert.h"
+#include "profile.h"
 
+/* Several searches can share the table at once (see testsuite_epd), so an
+ * entry may get half overwritten while it's being read. The key is stored
+ * xored with the data; a torn entry then fails to match any position, rather
+ * than handing some position another one's move. */
 typedef struct trans_entry_t {
 	uint64_t key;
 	trans_data_t value;
 } trans_entry_t;
 
+static inline uint64_t trans_data_bits(trans_data_t data)
+{
+	uint64_t bits;
+	memcpy(&bits, &data, sizeof(bits));
+	return bits;
+}
+
 /**
  * Statically initting the array is good because it avoids committing memory
  * we don't use, but depends, for efficiency not correctness, on the kernel
@@ -90,9 +103,10 @@ void trans_add(zobrist_t key, move_t move, uint8_t reps, int16_t value,
 	     (searchdepth > TRANS_SEARCHDEPTH(old)))) /* ...deeper search */
 	{
 		/* so we set the stuff to our new node */
-		array[bucket].key = key;
-		array[bucket].value = trans_data(move, reps, value, gamedepth,
-		                                 searchdepth, flag);
+		trans_data_t data = trans_data(move, reps, value, gamedepth,
+		                               searchdepth, flag);
+		array[bucket].key = key ^ trans_data_bits(data);
+		array[bucket].value = data;
 	}
 	return;
 }
@@ -105,10 +119,15 @@ static trans_data_t foo = { (uint8_t)(-1), (uint8_t)(-1),
                             (int16_t)(-1), (uint32_t)(-1) };
 trans_data_t trans_get(zobrist_t key)
 {
-	unsigned long bucket = key % TRANS_NUM_BUCKETS;
-	if (array[bucket].key == key)
+	unsigned long bucket;
+	trans_data_t data;
+	PROFILE_TIMER(TRANS_GET);
+
+	bucket = key % TRANS_NUM_BUCKETS;
+	data = array[bucket].value;
+	if ((array[bucket].key ^ trans_data_bits(data)) == key)
 	{
-		return array[bucket].value;
+		return data;
 	}
 	return foo;
 }
@@ -121,3 +140,12 @@ int trans_data_valid(trans_data_t foo)
 {
 	return (foo.flags != (uint8_t)(-1));
 }
+
+/**
+ * Forget everything, so that a search doesn't benefit from the ones before it
+ * (for repeatable test runs). This touches the whole table, so it's slow.
+ */
+void trans_clear()
+{
+	memset(array, 0, sizeof(array));
+}
@@ -67,6 +67,8 @@ typedef struct trans_data_t {
  * B: searchdepth
  * If we search deeper than 63 plies then we're in trouble.
  * */
+/* searchdepth for {check,stale}mate - as deep as it gets */
+#define TRANS_SEARCHDEPTH_TERMINAL 0x3f
 #define TRANS_FLAG_EXACT 0x2
 #define TRANS_FLAG_BETA  0x1
 #define TRANS_FLAG_ALPHA 0x0
@@ -88,5 +90,7 @@ void trans_add(zobrist_t, move_t, uint8_t, int16_t, uint8_t, uint8_t, uint8_t,
 trans_data_t trans_get(zobrist_t);
 /* Check if the return value from get() was valid */
 int trans_data_valid(trans_data_t);
+/* Empty the table */
+void trans_clear();
 
 #endif
@@ -0,0 +1,562 @@
+/****************************************************************************
+ * tune.c - fitting the eval's parameters to game results
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tune.h"
+#include "board.h"
+#include "search.h"
+#include "transposition.h"
+
+/* longest EPD line we read */
+#define TUNE_LINE 1024
+/* positions handed to a batch thread at a time */
+#define TUNE_CHUNK 4096
+/* rounds of the batch and the descent - the second one sees which
+ * positions are quiet with the new values */
+#ifndef TUNE_ROUNDS
+#define TUNE_ROUNDS 2
+#endif
+/* Adam's step size, in centipawns, and its decay rates */
+#ifndef TUNE_RATE
+#define TUNE_RATE 1.0
+#endif
+#define TUNE_BETA1 0.9
+#define TUNE_BETA2 0.999
+/* print the error every so many epochs */
+#define TUNE_REPORT 50
+
+/**
+ * The game result an EPD line is labelled with, or -1 if it isn't
+ */
+static float tune_parseresult(char *ops)
+{
+	char *c;
+	if (strstr(ops, "1/2-1/2") != NULL)
+	{
+		return 0.5;
+	}
+	if (strstr(ops, "1-0") != NULL)
+	{
+		return 1.0;
+	}
+	if (strstr(ops, "0-1") != NULL)
+	{
+		return 0.0;
+	}
+	if ((c = strchr(ops, '[')) != NULL)
+	{
+		return atof(c + 1);
+	}
+	return -1;
+}
+
+int tune_load(char *filename, tune_set_t *set)
+{
+	char line[TUNE_LINE];
+	FILE *file;
+	char *c;
+	int fields, size = 0;
+	float result;
+
+	if ((file = fopen(filename, "r")) == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
+	memset(set, 0, sizeof(tune_set_t));
+	while (fgets(line, TUNE_LINE, file))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		/* the position, up to the fourth space, then the label */
+		for (c = line, fields = 0; *c; c++)
+		{
+			if (*c == ' ' && ++fields == 4)
+			{
+				break;
+			}
+		}
+		if ((fields < 4) || ((result = tune_parseresult(c)) < 0))
+		{
+			continue;
+		}
+		*c = '\0';
+		if (set->count == size)
+		{
+			size = size ? (size * 2) : 65536;
+			set->positions = realloc(set->positions,
+			                         size * sizeof(tune_position_t));
+		}
+		memset(&set->positions[set->count], 0, sizeof(tune_position_t));
+		set->positions[set->count].fen = strdup(line);
+		set->positions[set->count].result = result;
+		set->count++;
+	}
+	fclose(file);
+	return 0;
+}
+
+void tune_free(tune_set_t *set)
+{
+	int i;
+	for (i = 0; i < set->count; i++)
+	{
+		free(set->positions[i].fen);
+	}
+	for (i = 0; i < set->num_blocks; i++)
+	{
+		free(set->blocks[i]);
+	}
+	free(set->positions);
+	free(set->blocks);
+	memset(set, 0, sizeof(tune_set_t));
+}
+
+/**
+ * What the batch threads share: the positions, and the next chunk nobody
+ * has taken yet
+ */
+typedef struct tune_batchrun_t {
+	tune_set_t *set;
+	int next;
+	pthread_mutex_t lock;
+} tune_batchrun_t;
+
+/**
+ * Score one position, and if it's quiet, trace it into terms (which has
+ * room for all the parameters). Returns how many terms it used.
+ */
+static int tune_position(board_t *board, tune_position_t *pos,
+                         tune_term_t *terms)
+{
+	float trace[EVAL_NUM_PARAMS];
+	float base;
+	int16_t coef;
+	int i, n = 0;
+
+	pos->quiet = 0;
+	pos->num_terms = 0;
+	pos->terms = NULL;
+	if (board_setfen(board, pos->fen))
+	{
+		return 0;
+	}
+	pos->qscore = search_quiesce(board);
+	pos->eval = eval(board);
+	if (board->tomove == BLACK)
+	{
+		pos->qscore = -pos->qscore;
+		pos->eval = -pos->eval;
+	}
+	/* anything left to capture (or a check or a mate) and the static eval
+	 * isn't what the position is worth */
+	if ((pos->qscore != pos->eval) || VALUE_ISMATE(pos->qscore) ||
+	    board_incheck(board))
+	{
+		return 0;
+	}
+	base = eval_trace(board, trace);
+	for (i = 0; i < EVAL_NUM_PARAMS; i++)
+	{
+		coef = (int16_t)lrintf(trace[i] * TUNE_COEF_SCALE);
+		if (coef == 0)
+		{
+			continue;
+		}
+		terms[n].param = i;
+		terms[n].coef = coef;
+		base -= (float)coef * eval_params[i] / TUNE_COEF_SCALE;
+		n++;
+	}
+	pos->quiet = 1;
+	pos->num_terms = n;
+	pos->base = base;
+	return n;
+}
+
+static void *tune_batchworker(void *arg)
+{
+	tune_batchrun_t *run = (tune_batchrun_t *)arg;
+	tune_set_t *set = run->set;
+	board_t *board = board_init();
+	tune_term_t *block;
+	int offset[TUNE_CHUNK];
+	int chunk, first, last, i, used;
+
+	while (1)
+	{
+		pthread_mutex_lock(&run->lock);
+		chunk = run->next++;
+		pthread_mutex_unlock(&run->lock);
+		first = chunk * TUNE_CHUNK;
+		if (first >= set->count)
+		{
+			break;
+		}
+		last = first + TUNE_CHUNK;
+		if (last > set->count)
+		{
+			last = set->count;
+		}
+		block = malloc((last - first) * EVAL_NUM_PARAMS *
+		               sizeof(tune_term_t));
+		used = 0;
+		for (i = first; i < last; i++)
+		{
+			offset[i - first] = used;
+			used += tune_position(board, &set->positions[i],
+			                      block + used);
+		}
+		/* keep only what got used, and point the positions into it */
+		block = realloc(block, (used ? used : 1) * sizeof(tune_term_t));
+		for (i = first; i < last; i++)
+		{
+			if (set->positions[i].quiet)
+			{
+				set->positions[i].terms = block + offset[i - first];
+			}
+		}
+		free(set->blocks[chunk]);
+		set->blocks[chunk] = block;
+	}
+	board_destroy(board);
+	return NULL;
+}
+
+/**
+ * Run the worker on that many threads, each with its own argument, and wait
+ * for them all. Any that can't be started, we run ourselves.
+ */
+static void tune_spawn(void *(*worker)(void *), void **args, int threads)
+{
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	int i, started;
+
+	for (started = 0; started < threads; started++)
+	{
+		if (pthread_create(&workers[started], NULL, worker, args[started]))
+		{
+			break;
+		}
+	}
+	for (i = started; i < threads; i++)
+	{
+		worker(args[i]);
+	}
+	for (i = 0; i < started; i++)
+	{
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+}
+
+static int tune_threads(int threads)
+{
+	if (threads < 1)
+	{
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	return (threads < 1) ? 1 : threads;
+}
+
+void tune_batch(tune_set_t *set, int threads)
+{
+	tune_batchrun_t run;
+	void **args;
+	int i, blocks = (set->count + TUNE_CHUNK - 1) / TUNE_CHUNK;
+
+	threads = tune_threads(threads);
+	if (set->num_blocks < blocks)
+	{
+		set->blocks = realloc(set->blocks, blocks * sizeof(tune_term_t *));
+		memset(set->blocks + set->num_blocks, 0,
+		       (blocks - set->num_blocks) * sizeof(tune_term_t *));
+		set->num_blocks = blocks;
+	}
+	/* quiescence scores from other parameters would be wrong */
+	trans_clear();
+	run.set = set;
+	run.next = 0;
+	pthread_mutex_init(&run.lock, NULL);
+	args = malloc(threads * sizeof(void *));
+	for (i = 0; i < threads; i++)
+	{
+		args[i] = &run;
+	}
+	tune_spawn(tune_batchworker, args, threads);
+	free(args);
+	pthread_mutex_destroy(&run.lock);
+}
+
+/**
+ * One thread's share of working out the error (and maybe its gradient):
+ * positions first to last-1
+ */
+typedef struct tune_errorpart_t {
+	tune_set_t *set;
+	float *theta;
+	double k;
+	int first, last;
+	double *grad;
+	double error;
+	int quiet;
+} tune_errorpart_t;
+
+/* what the error is about: the expected result for a score */
+static double tune_sigmoid(double k, double score)
+{
+	return 1.0 / (1.0 + exp(-k * score * M_LN10 / 400.0));
+}
+
+static void *tune_errorworker(void *arg)
+{
+	tune_errorpart_t *part = (tune_errorpart_t *)arg;
+	tune_position_t *pos;
+	double score, s, diff, d;
+	int i, j;
+
+	part->error = 0;
+	part->quiet = 0;
+	if (part->grad)
+	{
+		memset(part->grad, 0, EVAL_NUM_PARAMS * sizeof(double));
+	}
+	for (i = part->first; i < part->last; i++)
+	{
+		pos = &part->set->positions[i];
+		if (!pos->quiet)
+		{
+			continue;
+		}
+		score = pos->base;
+		for (j = 0; j < pos->num_terms; j++)
+		{
+			score += (double)pos->terms[j].coef *
+			         part->theta[pos->terms[j].param] / TUNE_COEF_SCALE;
+		}
+		s = tune_sigmoid(part->k, score);
+		diff = s - pos->result;
+		part->error += diff * diff;
+		part->quiet++;
+		if (part->grad)
+		{
+			d = 2 * diff * s * (1 - s) * part->k * M_LN10 / 400.0;
+			for (j = 0; j < pos->num_terms; j++)
+			{
+				part->grad[pos->terms[j].param] +=
+					d * pos->terms[j].coef / TUNE_COEF_SCALE;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * The mean squared error over the quiet positions with parameters theta,
+ * and if grad isn't NULL, its gradient
+ */
+static double tune_error(tune_set_t *set, float *theta, double k,
+                         int threads, double *grad)
+{
+	tune_errorpart_t *parts = malloc(threads * sizeof(tune_errorpart_t));
+	double *grads = malloc(threads * EVAL_NUM_PARAMS * sizeof(double));
+	void **args = malloc(threads * sizeof(void *));
+	double error = 0;
+	int i, j, quiet = 0;
+
+	for (i = 0; i < threads; i++)
+	{
+		parts[i].set = set;
+		parts[i].theta = theta;
+		parts[i].k = k;
+		parts[i].first = (long)set->count * i / threads;
+		parts[i].last = (long)set->count * (i + 1) / threads;
+		parts[i].grad = grad ? (grads + (i * EVAL_NUM_PARAMS)) : NULL;
+		args[i] = &parts[i];
+	}
+	tune_spawn(tune_errorworker, args, threads);
+	if (grad)
+	{
+		memset(grad, 0, EVAL_NUM_PARAMS * sizeof(double));
+	}
+	for (i = 0; i < threads; i++)
+	{
+		error += parts[i].error;
+		quiet += parts[i].quiet;
+		for (j = 0; grad && (j < EVAL_NUM_PARAMS); j++)
+		{
+			grad[j] += parts[i].grad[j];
+		}
+	}
+	for (j = 0; grad && quiet && (j < EVAL_NUM_PARAMS); j++)
+	{
+		grad[j] /= quiet;
+	}
+	free(parts);
+	free(grads);
+	free(args);
+	return quiet ? (error / quiet) : 0;
+}
+
+/**
+ * The sigmoid's scale that fits the current parameters best - a golden
+ * section search, since the error has just the one minimum
+ */
+static double tune_fitk(tune_set_t *set, float *theta, int threads)
+{
+	double lo = 0.05, hi = 4.0, golden = (sqrt(5.0) - 1) / 2;
+	double a = hi - golden * (hi - lo), b = lo + golden * (hi - lo);
+	double ea = tune_error(set, theta, a, threads, NULL);
+	double eb = tune_error(set, theta, b, threads, NULL);
+	int i;
+
+	for (i = 0; i < 40; i++)
+	{
+		if (ea < eb)
+		{
+			hi = b; b = a; eb = ea;
+			a = hi - golden * (hi - lo);
+			ea = tune_error(set, theta, a, threads, NULL);
+		}
+		else
+		{
+			lo = a; a = b; ea = eb;
+			b = lo + golden * (hi - lo);
+			eb = tune_error(set, theta, b, threads, NULL);
+		}
+	}
+	return (lo + hi) / 2;
+}
+
+/**
+ * Gradient descent (Adam) on the error, starting from theta
+ */
+static void tune_descend(tune_set_t *set, float *theta, double k,
+                         int threads, int epochs)
+{
+	double grad[EVAL_NUM_PARAMS];
+	double m[EVAL_NUM_PARAMS], v[EVAL_NUM_PARAMS];
+	double error, mhat, vhat;
+	int epoch, i;
+
+	memset(m, 0, sizeof(m));
+	memset(v, 0, sizeof(v));
+	for (epoch = 1; epoch <= epochs; epoch++)
+	{
+		error = tune_error(set, theta, k, threads, grad);
+		if ((epoch == 1) || (epoch % TUNE_REPORT == 0))
+		{
+			printf("Epoch %4d: error %.6f\n", epoch, error);
+		}
+		for (i = 0; i < EVAL_NUM_PARAMS; i++)
+		{
+			m[i] = TUNE_BETA1 * m[i] + (1 - TUNE_BETA1) * grad[i];
+			v[i] = TUNE_BETA2 * v[i] + (1 - TUNE_BETA2) * grad[i] * grad[i];
+			mhat = m[i] / (1 - pow(TUNE_BETA1, epoch));
+			vhat = v[i] / (1 - pow(TUNE_BETA2, epoch));
+			theta[i] -= TUNE_RATE * mhat / (sqrt(vhat) + 1e-12);
+		}
+	}
+}
+
+static unsigned long tune_ms(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((now.tv_sec - start->tv_sec) * 1000) +
+	       ((now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+int tune_run(char *filename, int threads, int epochs, char *outfile)
+{
+	tune_set_t set;
+	float theta[EVAL_NUM_PARAMS];
+	struct timespec start;
+	FILE *out;
+	double k = 0;
+	long value;
+	int round, i, quiet;
+
+	if (tune_load(filename, &set))
+	{
+		return -1;
+	}
+	threads = tune_threads(threads);
+	printf("Tuning on %d positions, %d threads\n", set.count, threads);
+	for (round = 0; round < TUNE_ROUNDS; round++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		tune_batch(&set, threads);
+		for (i = 0, quiet = 0; i < set.count; i++)
+		{
+			quiet += set.positions[i].quiet;
+		}
+		printf("Round %d: %d quiet positions (%lu ms)\n", round + 1,
+		       quiet, tune_ms(&start));
+		if (quiet == 0)
+		{
+			tune_free(&set);
+			return -1;
+		}
+		for (i = 0; i < EVAL_NUM_PARAMS; i++)
+		{
+			theta[i] = eval_params[i];
+		}
+		/* the scale stays put once it's fit, or the parameters could
+		 * all just grow to make up for it */
+		if (round == 0)
+		{
+			k = tune_fitk(&set, theta, threads);
+			printf("K %.4f\n", k);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		tune_descend(&set, theta, k, threads, epochs);
+		printf("Error %.6f after %d epochs (%lu ms)\n",
+		       tune_error(&set, theta, k, threads, NULL), epochs,
+		       tune_ms(&start));
+		for (i = 0; i < EVAL_NUM_PARAMS; i++)
+		{
+			value = lrintf(theta[i]);
+			if (value > INT16_MAX) { value = INT16_MAX; }
+			if (value < INT16_MIN) { value = INT16_MIN; }
+			if (value != eval_params[i])
+			{
+				eval_setparam(eval_paramnames[i], value);
+			}
+		}
+	}
+	tune_free(&set);
+
+	out = (outfile != NULL) ? fopen(outfile, "w") : stdout;
+	if (out == NULL)
+	{
+		perror(outfile);
+		return -1;
+	}
+	eval_saveparams(out);
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return 0;
+}
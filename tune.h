@@ -0,0 +1,92 @@
+/****************************************************************************
+ * tune.h - fitting the eval's parameters to game results
+ * copyright (C) 2008 Ben Blum
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ ****************************************************************************/
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdint.h>
+#include "eval.h"
+
+/* how many passes over the data the tuner makes by default */
+#ifndef TUNE_EPOCHS
+#define TUNE_EPOCHS 500
+#endif
+
+/**
+ * One parameter's part in a position's eval: the trace coefficient, in
+ * 64ths so a position's terms stay small when there are millions of them
+ */
+#define TUNE_COEF_SCALE 64
+typedef struct tune_term_t {
+	uint8_t param;
+	int16_t coef;
+} tune_term_t;
+
+/**
+ * A labelled position, and what tune_batch() found out about it, all from
+ * white's point of view: the game's result (1, 0.5 or 0), the quiescence
+ * and static scores, and for a quiet position (where they're the same), the
+ * eval as a linear function of the parameters - base plus each term's coef
+ * times its parameter.
+ */
+typedef struct tune_position_t {
+	char *fen;
+	float result;
+	int16_t qscore;
+	int16_t eval;
+	unsigned char quiet;
+	uint8_t num_terms;
+	float base;
+	tune_term_t *terms;
+} tune_position_t;
+
+typedef struct tune_set_t {
+	tune_position_t *positions;
+	int count;
+	/* where the terms live, a block for each chunk of positions */
+	tune_term_t **blocks;
+	int num_blocks;
+} tune_set_t;
+
+/**
+ * Read positions from an EPD file labelled with results: "1-0", "0-1" or
+ * "1/2-1/2" (as in a c9 or result operation) or [1.0], [0.5], [0.0] after the
+ * position. Unlabelled or illegal lines are skipped. Returns -1 if the file
+ * can't be read.
+ */
+int tune_load(char *filename, tune_set_t *);
+
+/**
+ * Run quiescence and the eval on every position, with the current
+ * parameters, on that many threads (0 for one per CPU), and trace the quiet
+ * ones. Can be run again after the parameters change.
+ */
+void tune_batch(tune_set_t *, int threads);
+
+void tune_free(tune_set_t *);
+
+/**
+ * Tune the eval on the positions in an EPD file: the batch, then gradient
+ * descent on how far the sigmoid of each quiet position's eval is from its
+ * result, for so many epochs, then the batch again with the new values and
+ * another round. Writes the parameters to outfile (stdout if NULL), in the
+ * format eval_loadparams() reads. Returns -1 if there's nothing to tune on.
+ */
+int tune_run(char *filename, int threads, int epochs, char *outfile);
+
+#endif
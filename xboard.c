@@ -19,22 +19,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "engine.h"
+#include "testsuite.h"
+#include "tune.h"
+#include "bitbase.h"
+#include "eval.h"
+#include "nnue.h"
 #include "util/linkedlist_u32.h"
+#include "util/linkedlist.h"
 
 void get_cmd();
+void read_cmd(char *);
+void *input_thread(void *);
+int input_interrupts(char *str);
 void exit_error(char *);
 void output(char *);
+void output_xboard(char *);
 /* command-handling routines */
 void cmd_new();
+void set_evaluator();
 void makemove();
 int usermove(char *str);
 int input_ismove(char *str);
 void checkgameover();
+void ponder();
+int ponder_continues(char *str);
 
 #define BUF_SIZE 2048
 char inbuf[BUF_SIZE];
-char outbuf[BUF_SIZE];
+/* each thread that prints (the searchers, too) formats into its own */
+__thread char outbuf[BUF_SIZE];
+/* most of a file name we'll put in a message, so the rest of it fits */
+#define NAME_SHOWN (BUF_SIZE / 2)
 
 FILE *ttyout;
 #ifndef TTYOUT_COLOR
@@ -59,20 +76,129 @@ char opponent[BUF_SIZE];
 unsigned char debug;
 
 engine_t *e = NULL;
+/* kept here so they survive "new" - xboard only sends options once */
+unsigned int move_overhead = ENGINE_MOVE_OVERHEAD;
+unsigned long node_limit = 0;
+/* the neural network evaluator, and where to load it from */
+unsigned char use_nnue = 0;
+char nnue_file[BUF_SIZE] = ENGINE_NNUE_FILE;
 /* Used for xboard's "force" mode, when examining or resuming adjourned */
 unsigned char force_mode;
+/* xboard's "hard" and "easy" - whether to think on the opponent's time */
+unsigned char ponder_enabled = 0;
+/* xboard's "analyze" - search whatever position we're shown, forever */
+unsigned char analyze_mode = 0;
+/* the searcher prints from the ponder thread */
+pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+/* once the game starts, a thread reads stdin so that commands can reach a
+ * search while the main loop is busy with it. the main loop takes the
+ * commands from this queue, in order */
+linkedlist_t *cmd_queue;
+pthread_t cmd_thread;
+pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cmd_ready = PTHREAD_COND_INITIALIZER;
 
-int main()
+int main(int argc, char **argv)
 {
 	int protover = -1;
+	int how, i;
 	force_mode = 0;
 	debug = 0;
 	opponent[0] = '\0';
+	/* solve the endgame bitbases before anything can search */
+	bitbase_init();
+
+	/* "bistromath test [depth] [name=value ...]" runs the test positions
+	 * instead, with the pruning parameters given, and "bistromath bench
+	 * [depth]" the benchmark */
+	if (argc > 1 && (0 == strcmp(argv[1], "test") ||
+	                 0 == strcmp(argv[1], "bench")))
+	{
+		/* the searcher's chatter would bury the results */
+		ttyout = fopen("/dev/null", "w");
+		if (0 == strcmp(argv[1], "test"))
+		{
+			char name[64];
+			int value;
+			for (i = 3; i < argc; i++)
+			{
+				if ((2 != sscanf(argv[i], "%63[^=]=%d", name, &value)) ||
+				    search_setparam(name, value))
+				{
+					fprintf(stderr, "Not a search parameter: %s\n",
+					        argv[i]);
+					fclose(ttyout);
+					return 1;
+				}
+			}
+			testsuite_run((argc > 2) ? atoi(argv[2]) :
+			              TESTSUITE_DEFAULT_DEPTH);
+		}
+		else
+		{
+			testsuite_bench((argc > 2) ? atoi(argv[2]) :
+			                TESTSUITE_BENCH_DEPTH);
+		}
+		fclose(ttyout);
+		return 0;
+	}
+	/* "bistromath epd <file> [ms|dN] [threads]" runs an EPD test suite,
+	 * with a time or a depth (dN) per position */
+	if (argc > 2 && 0 == strcmp(argv[1], "epd"))
+	{
+		unsigned int ms = 0;
+		int depth = 0;
+		int result;
+		if (argc > 3 && argv[3][0] == 'd')
+		{
+			depth = atoi(argv[3] + 1);
+		}
+		else if (argc > 3)
+		{
+			ms = atoi(argv[3]);
+		}
+		ttyout = fopen("/dev/null", "w");
+		result = testsuite_epd(argv[2], ms, depth,
+		                       (argc > 4) ? atoi(argv[4]) : 1);
+		fclose(ttyout);
+		return result ? 1 : 0;
+	}
+
+	/* "bistromath nnuebench <file> [depth]" compares the classical eval
+	 * with a network */
+	if (argc > 2 && 0 == strcmp(argv[1], "nnuebench"))
+	{
+		int result;
+		ttyout = fopen("/dev/null", "w");
+		result = testsuite_nnuebench(argv[2], (argc > 3) ? atoi(argv[3]) :
+		                             TESTSUITE_BENCH_DEPTH);
+		fclose(ttyout);
+		return result ? 1 : 0;
+	}
+
+	/* "bistromath tune <file> [threads] [epochs] [outfile]" fits the eval's
+	 * parameters to the results the positions in an EPD file are
+	 * labelled with */
+	if (argc > 2 && 0 == strcmp(argv[1], "tune"))
+	{
+		int result;
+		ttyout = fopen("/dev/null", "w");
+		result = tune_run(argv[2], (argc > 3) ? atoi(argv[3]) : 0,
+		                  (argc > 4) ? atoi(argv[4]) : TUNE_EPOCHS,
+		                  (argc > 5) ? argv[5] : NULL);
+		fclose(ttyout);
+		return result ? 1 : 0;
+	}
 
 	/* initial setup */
 	do
 	{
+		/* no terminal (e.g. run from a script) - use stderr */
 		ttyout = fopen("/dev/tty", "w");
+		if (ttyout == NULL)
+		{
+			ttyout = stderr;
+		}
 		
 		setbuf(stdout, NULL);
 		
@@ -97,14 +223,44 @@ int main()
 		/* output: "feature [...]" */
 		fprintf(ttyout, "%sNow giving feature command...%s",
 		        TTYOUT_COLOR, DEFAULT_COLOR);
-		printf("feature sigint=0 myname=\"%s\" ping=1 done=1\n", ENGINE_NAME);
+		printf("feature sigint=0 myname=\"%s\" ping=1 setboard=1\n",
+		       ENGINE_NAME);
+		printf("feature option=\"Move Overhead -spin %d 0 10000\"\n",
+		       ENGINE_MOVE_OVERHEAD);
+		printf("feature option=\"Node Limit -spin 0 0 2000000000\"\n");
+		printf("feature option=\"Use NNUE -check 0\"\n");
+		printf("feature option=\"NNUE File -file %s\"\n", ENGINE_NNUE_FILE);
+		printf("feature option=\"Eval Params -file \"\n");
+		for (i = 0; i < SEARCH_NUM_PARAMS; i++)
+		{
+			printf("feature option=\"%s -spin %d 0 1000\"\n",
+			       search_paramnames[i], search_params[i]);
+		}
+		printf("feature done=1\n");
 		fprintf(ttyout, "%sDone.%s\n", TTYOUT_COLOR, DEFAULT_COLOR);
 	} while (0);
 
+	cmd_queue = ll_init((data_compare_fn)strcmp, free);
+	if (pthread_create(&cmd_thread, NULL, input_thread, NULL))
+	{
+		exit_error("Couldn't start the input thread.");
+	}
+
 	/* main getcommand/parse/execute loop */
 	while (1)
 	{
 		get_cmd();
+		/* most commands need the ponder search out of the way first */
+		if (e && e->pondering && !ponder_continues(inbuf))
+		{
+			engine_ponder_stop(e);
+		}
+		/* the input thread stopped any search for this one; that
+		 * search is done with, so the next one can go ahead */
+		if ((how = input_interrupts(inbuf)))
+		{
+			search_resume(how);
+		}
 		/* interpret the commands received */
 		if (0 == strcmp(inbuf, "new"))
 		{
@@ -117,6 +273,24 @@ int main()
 		{
 			force_mode = 1;
 		}
+		/* thinking output on/off */
+		else if (0 == strcmp(inbuf, "post"))
+		{
+			search_post = 1;
+		}
+		else if (0 == strcmp(inbuf, "nopost"))
+		{
+			search_post = 0;
+		}
+		/* pondering on/off */
+		else if (0 == strcmp(inbuf, "hard"))
+		{
+			ponder_enabled = 1;
+		}
+		else if (0 == strcmp(inbuf, "easy"))
+		{
+			ponder_enabled = 0;
+		}
 		/* the ping command, which avoids race conditions */
 		else if (0 == strncmp(inbuf, "ping", 4))
 		{
@@ -128,36 +302,168 @@ int main()
 		else if (0 == strncmp(inbuf, "level", 5))
 		{
 			/* mps is only for the sscanf argument, its value is
-			 * ignored. time in mins, inc = increment in secs*/
-			unsigned int mps = 0, time = 0, inc = 0;
-			sscanf(inbuf, "level %u %u %u", &mps, &time, &inc);
+			 * ignored. time in mins (or mins:secs), inc =
+			 * increment in secs */
+			unsigned int mps = 0, mins = 0, secs = 0, inc = 0;
+			char base[BUF_SIZE];
+			sscanf(inbuf, "level %u %s %u", &mps, base, &inc);
+			sscanf(base, "%u:%u", &mins, &secs);
 			/* set the values in the engine */
-			e->time_remaining = time * 60;
-			e->time_increment = inc;
+			e->time_remaining = ((mins * 60) + secs) * 1000;
+			e->time_increment = inc * 1000;
+			e->movetime = 0;
+		}
+		/* fixed seconds per move, instead of a clock */
+		else if (0 == strncmp(inbuf, "st ", 3))
+		{
+			unsigned int secs = 0;
+			sscanf(inbuf, "st %u", &secs);
+			e->movetime = secs * 1000;
+		}
+		/* search no deeper than this; "new" clears it */
+		else if (0 == strncmp(inbuf, "sd ", 3))
+		{
+			unsigned int depth = 0;
+			sscanf(inbuf, "sd %u", &depth);
+			e->depth_limit = (depth < SEARCHER_MAX_DEPTH) ? depth :
+			                 (SEARCHER_MAX_DEPTH - 1);
+		}
+		/* count our clock in nodes, at this many per second */
+		else if (0 == strncmp(inbuf, "nps ", 4))
+		{
+			unsigned int nps = 0;
+			sscanf(inbuf, "nps %u", &nps);
+			e->nps = nps;
 		}
 		else if (0 == strncmp(inbuf, "time", 4))
 		{
 			unsigned int time;
 			sscanf(inbuf, "time %u", &time);
 			/* xboard gives us centiseconds */
-			e->time_remaining = time / 100;
+			e->time_remaining = time * 10;
+		}
+		/* engine-defined options, from the feature command */
+		else if (0 == strncmp(inbuf, "option", 6))
+		{
+			unsigned int overhead, check;
+			unsigned long nodes;
+			char name[64];
+			int value;
+			if (1 == sscanf(inbuf, "option Move Overhead=%u", &overhead))
+			{
+				move_overhead = overhead;
+				if (e)
+				{
+					e->move_overhead = move_overhead;
+				}
+			}
+			else if (1 == sscanf(inbuf, "option Node Limit=%lu", &nodes))
+			{
+				node_limit = nodes;
+				if (e)
+				{
+					e->node_limit = node_limit;
+				}
+			}
+			else if (1 == sscanf(inbuf, "option Use NNUE=%u", &check))
+			{
+				use_nnue = check;
+				set_evaluator();
+			}
+			else if (0 == strncmp(inbuf, "option NNUE File=", 17))
+			{
+				strncpy(nnue_file, inbuf + 17, BUF_SIZE - 1);
+				set_evaluator();
+			}
+			/* the game's board counted its material with the old
+			 * piece values; the moves from here on would take
+			 * pieces off with the new ones */
+			else if (0 == strncmp(inbuf, "option Eval Params=", 19))
+			{
+				if (eval_loadparams(inbuf + 19))
+				{
+					snprintf(outbuf, BUF_SIZE-1, "ENGINE: Couldn't load eval parameters from %.*s",
+					         NAME_SHOWN, inbuf + 19);
+				}
+				else
+				{
+					if (e)
+					{
+						board_recount(e->board);
+					}
+					snprintf(outbuf, BUF_SIZE-1, "ENGINE: Using the eval parameters in %.*s",
+					         NAME_SHOWN, inbuf + 19);
+				}
+				output(outbuf);
+			}
+			/* the pruning rules' depths and margins, by name */
+			else if ((2 == sscanf(inbuf, "option %63[^=]=%d", name,
+			                      &value)) &&
+			         (0 == search_setparam(name, value)))
+			{
+				snprintf(outbuf, BUF_SIZE-1, "ENGINE: Search parameter %s is now %d",
+				         name, value);
+				output(outbuf);
+			}
 		}
 		/* commands for making moves */
+		else if (0 == strcmp(inbuf, "analyze"))
+		{
+			analyze_mode = 1;
+			force_mode = 1;
+			search_post = 1;
+		}
+		else if (0 == strcmp(inbuf, "exit"))
+		{
+			analyze_mode = 0;
+		}
+		/* status of the analysis; it keeps going */
+		else if (0 == strcmp(inbuf, "."))
+		{
+			if (analyze_mode && e->pondering)
+			{
+				search_poststatus();
+			}
+		}
+		else if (0 == strncmp(inbuf, "setboard ", 9))
+		{
+			if (engine_setboard(e, inbuf + 9))
+			{
+				printf("tellusererror Illegal position\n");
+			}
+		}
+		else if (0 == strcmp(inbuf, "undo"))
+		{
+			engine_undomove(e);
+		}
+		else if (0 == strcmp(inbuf, "remove"))
+		{
+			if (engine_undomove(e))
+			{
+				engine_undomove(e);
+			}
+		}
 		else if (0 == strcmp(inbuf, "go"))
 		{
 			force_mode = 0;
+			analyze_mode = 0;
 			makemove();
 			checkgameover();
+			ponder();
 		}
 		else if (input_ismove(inbuf))
 		{
 			if (usermove(inbuf))
 			{
-				checkgameover();
-				if (!force_mode)
+				if (!analyze_mode)
+				{
+					checkgameover();
+				}
+				if (!force_mode && !analyze_mode)
 				{
 					makemove();
 					checkgameover();
+					ponder();
 				}
 			}
 			else
@@ -228,28 +534,118 @@ int main()
 		{
 			break;
 		}
+		/* whatever the command was, analysis goes on with the position
+		 * as it now stands */
+		if (analyze_mode && !e->pondering)
+		{
+			engine_analyze(e);
+		}
 	}
 	
 	engine_destroy(e);
-	fclose(ttyout);
+	if (ttyout != stderr)
+	{
+		fclose(ttyout);
+	}
 	return 0;
 }
 
 
-void get_cmd()
+/**
+ * Read a command into inbuf. This runs while the ponder thread is using
+ * outbuf, so it has its own buffer for printing.
+ */
+void read_cmd(char *line)
 {
-	if (fgets(inbuf, BUF_SIZE-1, stdin)) {
-		if (inbuf[strlen(inbuf)-1] == '\n')
+	char buf[BUF_SIZE];
+	if (fgets(line, BUF_SIZE-1, stdin)) {
+		if (line[strlen(line)-1] == '\n')
 		{
-			inbuf[strlen(inbuf)-1] = '\0';
+			line[strlen(line)-1] = '\0';
 		}
-		snprintf(outbuf, BUF_SIZE-1, "STDIN: %s", inbuf);
-		output(outbuf);
+		snprintf(buf, BUF_SIZE-1, "STDIN: %s", line);
+		output(buf);
 	} else {
-		inbuf[0] = 0;
-		snprintf(outbuf, BUF_SIZE-1, "STDIN: EOF - use 'quit' to exit!");
-		output(outbuf);
+		line[0] = 0;
+		snprintf(buf, BUF_SIZE-1, "STDIN: EOF");
+		output(buf);
+	}
+}
+
+/**
+ * Get the next command into inbuf: straight from stdin during the handshake,
+ * and from the input thread's queue after that, waiting if need be
+ */
+void get_cmd()
+{
+	char *cmd;
+	if (cmd_queue == NULL)
+	{
+		read_cmd(inbuf);
+		return;
+	}
+	pthread_mutex_lock(&cmd_lock);
+	while (cmd_queue->count == 0)
+	{
+		pthread_cond_wait(&cmd_ready, &cmd_lock);
+	}
+	cmd = ll_remove_index(cmd_queue, 0);
+	pthread_mutex_unlock(&cmd_lock);
+	strcpy(inbuf, cmd);
+	free(cmd);
+}
+
+/**
+ * Read commands as they come and queue them up for the main loop. A command
+ * that has to stop a search does so right away, not when the main loop gets
+ * around to it. At the end of input we queue a quit, since nothing else is
+ * ever coming.
+ */
+void *input_thread(void *arg)
+{
+	char line[BUF_SIZE];
+	unsigned char how;
+	(void)arg;
+
+	do
+	{
+		read_cmd(line);
+		if (feof(stdin))
+		{
+			strcpy(line, "quit");
+		}
+		if ((how = input_interrupts(line)))
+		{
+			search_interrupt(how);
+		}
+		pthread_mutex_lock(&cmd_lock);
+		ll_add(cmd_queue, strdup(line));
+		pthread_cond_signal(&cmd_ready);
+		pthread_mutex_unlock(&cmd_lock);
+	} while (strcmp(line, "quit"));
+	return NULL;
+}
+
+/**
+ * Does this command have to cut a search short? Move-now of course, and
+ * anything that ends the game or makes it not our move - xboard expects us
+ * to stop thinking at once, not to move. Returns SEARCH_MOVENOW or
+ * SEARCH_ABORT, or 0 for an ordinary command.
+ */
+int input_interrupts(char *str)
+{
+	if (0 == strcmp(str, "?"))
+	{
+		return SEARCH_MOVENOW;
+	}
+	if ((0 == strcmp(str, "quit")) ||
+	    (0 == strcmp(str, "force")) ||
+	    (0 == strcmp(str, "new")) ||
+	    (0 == strncmp(str, "result", 6)))
+	{
+		return SEARCH_ABORT;
 	}
+	return 0;
 }
 
 /**
@@ -268,6 +664,7 @@ void exit_error(char *msg)
  */
 void output(char *msg)
 {
+	pthread_mutex_lock(&output_lock);
 	if (debug)
 	{
 		printf("tellics k %s\n", msg);
@@ -279,39 +676,58 @@ void output(char *msg)
 		        DEFAULT_COLOR);
 		fflush(ttyout);
 	}
+	pthread_mutex_unlock(&output_lock);
+	return;
+}
+
+/**
+ * Send a line to xboard (e.g. thinking output) from the search, which may be
+ * running in the ponder thread
+ */
+void output_xboard(char *msg)
+{
+	pthread_mutex_lock(&output_lock);
+	printf("%s\n", msg);
+	fflush(stdout);
+	pthread_mutex_unlock(&output_lock);
 	return;
 }
 
+/**
+ * Debugging output before we search; with a ponder hit the ponder search is
+ * still using outbuf at this point, so this prints from its own buffer.
+ */
 void printmoves()
 {
+	char buf[BUF_SIZE];
 	movelist_t list;
 	
 	/* move list */
 	board_generatemoves(e->board, &list);
-	snprintf(outbuf, BUF_SIZE-1, "ENGINE: Moves possible: ");
+	snprintf(buf, BUF_SIZE-1, "ENGINE: Moves possible: ");
 	while (!movelist_isempty(&list))
 	{
 		move_t move = movelist_remove_max(&list);
 		char *str = move_tostring(move);
-		strcat(outbuf, str);
-		strcat(outbuf, " ");
+		strcat(buf, str);
+		strcat(buf, " ");
 		free(str);
 	}
-	output(outbuf);
+	output(buf);
 	movelist_destroy(&list);
 	
 	/* capture list*/
 	board_generatecaptures(e->board, &list);
-	snprintf(outbuf, BUF_SIZE-1, "ENGINE: Captures possible: ");
+	snprintf(buf, BUF_SIZE-1, "ENGINE: Captures possible: ");
 	while (!movelist_isempty(&list))
 	{
 		move_t move = movelist_remove_max(&list);
 		char *str = move_tostring(move);
-		strcat(outbuf, str);
-		strcat(outbuf, " ");
+		strcat(buf, str);
+		strcat(buf, " ");
 		free(str);
 	}
-	output(outbuf);
+	output(buf);
 	movelist_destroy(&list);
 	
 	return;
@@ -324,9 +740,36 @@ void cmd_new()
 {
 	engine_destroy(e);
 	e = engine_init(getbestmove);
+	e->move_overhead = move_overhead;
+	e->node_limit = node_limit;
 	return;
 }
 
+/**
+ * Switch between the classical eval and the network, per the options
+ */
+void set_evaluator()
+{
+	if (!use_nnue)
+	{
+		eval_usenetwork(NULL);
+		output("ENGINE: Using the classical eval");
+	}
+	else if (eval_usenetwork(nnue_file))
+	{
+		snprintf(outbuf, BUF_SIZE-1, "ENGINE: Couldn't load a network from %.*s, using the %s eval",
+		         NAME_SHOWN, nnue_file,
+		         nnue_loaded() ? "old network's" : "classical");
+		output(outbuf);
+	}
+	else
+	{
+		snprintf(outbuf, BUF_SIZE-1, "ENGINE: Using the network in %.*s",
+		         NAME_SHOWN, nnue_file);
+		output(outbuf);
+	}
+}
+
 /**
  * Have the engine make a move
  */
@@ -339,6 +782,12 @@ void makemove()
 	
 	/* move is applied here */
 	str = engine_generatemove(e);
+	if (str == NULL)
+	{
+		/* the command that cut the search off will say what now */
+		free(fen);
+		return;
+	}
 	snprintf(outbuf, BUF_SIZE-1, "ENGINE: Current board state is %s...",
 	         fen);
 	output(outbuf);
@@ -373,15 +822,20 @@ int input_ismove(char *str)
 	return !!(move_fromstring(str));
 }
 
+/**
+ * Print the result if the game is over. Can run during a ponder hit, before
+ * the search is done with outbuf, so it prints from its own buffer.
+ */
 void checkgameover()
 {
+	char buf[BUF_SIZE];
 	char *result;
 	int type;
 	if ((type = engine_checkgameover(e, &result)) != 0)
 	{
-		snprintf(outbuf, BUF_SIZE-1,"ENGINE: Game over: %s type %d",
+		snprintf(buf, BUF_SIZE-1,"ENGINE: Game over: %s type %d",
 		         result, type);
-		output(outbuf);
+		output(buf);
 		if (type == 2)
 		{
 			printf("offer draw\n");
@@ -393,6 +847,38 @@ void checkgameover()
 	return;
 }
 
+/**
+ * Think on the opponent's time after making our move, if we're allowed
+ */
+void ponder()
+{
+	char *result;
+	if (ponder_enabled && !force_mode && !engine_checkgameover(e, &result))
+	{
+		engine_ponder(e);
+	}
+	return;
+}
+
+/**
+ * Commands that can be handled while the ponder search keeps going: clock
+ * updates and pings (which xboard sends around the opponent's move), the
+ * analysis status request, move-now (there's no move of ours to hurry), and
+ * the move we're pondering on, of course.
+ */
+int ponder_continues(char *str)
+{
+	return (0 == strncmp(str, "time", 4)) ||
+	       (0 == strncmp(str, "otim", 4)) ||
+	       (0 == strncmp(str, "ping", 4)) ||
+	       (0 == strcmp(str, "hard")) ||
+	       (0 == strcmp(str, "post")) ||
+	       (0 == strcmp(str, "nopost")) ||
+	       (0 == strcmp(str, ".")) ||
+	       (0 == strcmp(str, "?")) ||
+	       (input_ismove(str) && engine_ponder_expects(e, str));
+}
+
 #include <unistd.h>
 #include <signal.h>
 